@@ -1,17 +1,28 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include "ring.h"
+#include "proto.h"
 
 #define wb_clk_i    25*1000000                     // Clock runs at 100Khz
 #define prescale    (wb_clk_i/(5*100*1000)-1)    // Value to write to prescale register to set clk frequency to 100Khz (see p4 of the IIC manual)
 
-#define PRERlo  (*(volatile unsigned char *)(0x00408000))    // Clock prescale register low byte
-#define PRERhi  (*(volatile unsigned char *)(0x00408002))    // Clock prescale register high byte
-#define CTR     (*(volatile unsigned char *)(0x00408004))    // Control register
-#define TXR     (*(volatile unsigned char *)(0x00408006))    // Transmit register
-#define RXR     (*(volatile unsigned char *)(0x00408006))    // Receive register
-#define CR      (*(volatile unsigned char *)(0x00408008))    // Command register
-#define SR      (*(volatile unsigned char *)(0x00408008))    // Status register
+#define IIC_SPEED_STANDARD   100000L    // Standard mode SCL
+#define IIC_SPEED_FAST       400000L    // Fast mode SCL
+#define IIC_SPEED_FAST_PLUS 1000000L    // Fast mode plus SCL
+#define BUS_FREE_LIMIT       100000     // Max polls waiting for the bus to go idle before changing speed
+#ifndef IIC_BUSES
+#define IIC_BUSES                 1     // I2C cores in the FPGA build, with 2 the ADC/DAC has its own (see iic_devices)
+#endif
+
+// Register access backend, see IIC_board.h
+#if defined(IIC_SIM)
+#include "IIC_sim.h"    // Host simulation of the I2C core, EEPROM, ADC/DAC and serial port
+#elif defined(IIC_BACKEND)
+#include IIC_BACKEND    // e.g. -DIIC_BACKEND='"my_regs.h"'
+#else
+#include "IIC_board.h"  // Memory mapped registers of the 68K board
+#endif
 
 #define NOP     0   // Don't set STA or STO
 #define STA     1   // Set STA
@@ -23,20 +34,396 @@
 #define EEPROM_ADDR_UPPER  0x54 //0b1010100 // Slave address of lower block
 #define ADCDAC_ADDR        0x48 //0b1001000 // Slave address of ADC/DAC
 
-#define RS232_Status      *(volatile unsigned char *)(0x00400040)
-#define RS232_TxData      *(volatile unsigned char *)(0x00400042)
-#define RS232_RxData      *(volatile unsigned char *)(0x00400042)
+#define EEPROM_PAGE_SIZE   0x80     // 24LC1025 page write buffer is 128 bytes
+#define EEPROM_SIZE        0x20000  // Two 64K byte blocks
+#define ACK_POLL_LIMIT     5000     // Max control byte retries while the EEPROM finishes a write cycle
+#define CRC_PAGE_DATA      (EEPROM_PAGE_SIZE - 4)  // Data bytes in a CRC protected page
+#define VERIFY_RETRIES        2     // Rewrites by eeprom_write_verified() when the CRC read back differs
+#define CACHE_LINES           8     // Pages held by the write-back cache (128 bytes each)
+#define LOAD_DATA             1     // load_record(): a data record
+#define LOAD_SKIP             2     // load_record(): header, count or address record, nothing to write
+#define LOAD_END              0     // load_record(): end record, or 'q' typed between records
+#define LOAD_LINE   (2 * (255 + 6)) // Hex digits in the longest record after 'S' and its type or ':'
+#define HEX_LINE_BYTES       16     // Bytes per hex dump line
+#define HEX_LINE_MAX  (7 + 3 * HEX_LINE_BYTES)     // Characters in a hex dump line from hex_format_line()
+#define UPDATE_PAGES          8     // Pages that can hold pending eeprom_update() data
+
+// Log structured record store, see log_append()
+#define LOG_START       0x00000     // First page of the log
+#define LOG_PAGES          1022     // Pages in the log, used as a ring
+#define LOG_KEYS             24     // Record keys 0 to LOG_KEYS-1, limited by the checkpoint size
+#define LOG_MAGIC          0xA5     // First byte of every log page
+#define LOG_HDR               4     // Page header: magic, sequence (2 bytes), record count
+#define LOG_NONE             -1     // log_index page: no record for this key
+#define LOG_PENDING          -2     // log_index page: record is in the page being built
+#define LOG_CHECKPOINT  0x1FF00     // Two checkpoint pages after the log
+#define LOG_CP_MAGIC       0x5C     // First byte of a checkpoint page
+#define LOG_CP_INTERVAL      16     // Log pages written between checkpoints
+
+// Compressed sensor log, one block per EEPROM page, see slog_add()
+#define SLOG_MAGIC         0xD5     // First byte of every block
+#define SLOG_CHANNELS         3     // Potentiometer, photo resistor, thermistor
+#define SLOG_HDR             10     // magic, session, frames, base values, widths (2 bytes), CRC-16 (2 bytes)
+#define SLOG_MAX_FRAMES     255
+#define SLOG_BITS          ((EEPROM_PAGE_SIZE - SLOG_HDR) * 8)  // Room for packed deltas in a block
+#define SLOG_RAM_PAGES       64     // RAM log used by slog_bench()
+#define SLOG_BENCH_FRAMES  2048
+
+// Status codes returned by the bulk EEPROM functions
+#define IIC_OK              0
+#define IIC_ERR_NACK       -1   // Slave did not acknowledge a byte
+#define IIC_ERR_BUSY       -2   // Acknowledge polling timed out
+#define IIC_ERR_RANGE      -3   // Address or size outside of the EEPROM
+#define IIC_ERR_CRC        -4   // Data read back doesn't match its CRC
+
+// Interrupt driven transfers
+#define IIC_IRQ_VECTOR     30       // I2C core irq is wired to IRQ6, level 6 autovector
+#define IIC1_IRQ_VECTOR    29       // Second I2C core, wired to IRQ5, level 5 autovector
+#define XFER_PENDING        1       // Descriptor status while queued or in progress
+#define XFER_NOSTOP      0x01       // Keep the bus after the descriptor, next one starts with a repeated start
+#define XFER_CONTINUE    0x02       // Read carries on from the previous descriptor's sequential read
+
+// Continuous ADC acquisition
+#define ADC_CONTROL      0x46       // Analog output on, four single ended inputs, auto-increment from channel 2
+#define ADC_FRAME           4       // One sample from each channel
+#define ADC_BLOCK          32       // Bytes read per descriptor, a whole number of frames
+#define ADC_RING_SIZE    1024       // Power of two
+#define ADC_FORWARD         1       // Consumer modes, see ADCStream()
+#define ADC_AVERAGE         2
+#define ADC_DECIMATE        3
+#define ADC_FILTER          4
+
+// DAC waveform generator
+#define DAC_CONTROL      0x40       // Analog output on, the DAC takes every byte written after it
+#define WAVE_SIZE         256       // Samples per period in wave_table, indexed by the top 8 bits of the phase
+#define WAVE_BLOCK        256       // Samples sent between checks for a key or a NACK
+#define WAVE_SINE           1
+#define WAVE_TRIANGLE       2
+#define WAVE_SAWTOOTH       3
+#define WAVE_USER           4       // Loaded from the EEPROM
+
+// Sensor conversion, see therm_decidegrees()
+#define SENSOR_SHIFT        3       // Conversion tables have an entry every 8 counts
+#define SENSOR_POINTS      33       // 256 / 8 + 1, the last entry is for interpolating above 248
+#define SENSOR_R_FIXED  10000.0     // Pull-up above the thermistor and the photo resistor
+#define SENSOR_BENCH   100000L      // Samples converted by sensor_bench()
+
+// ADC stream filters, see filter_block()
+#define FILTER_MOVING       1       // Moving average of taps samples
+#define FILTER_IIR          2       // Exponential, y += (x - y) / 2^shift
+#define FILTER_FIR          3       // Q15 coefficients
+#define FILTER_MAX_TAPS    32
+#define FILTER_AVG_TAPS     8       // Moving average length used by ADCFilter()
+#define FILTER_IIR_SHIFT    3       // IIR smoothing used by ADCFilter()
+#define FILTER_BENCH    65536L      // Samples run through each filter by filter_bench()
+#define HEX_BENCH       65536L      // Bytes parsed and formatted by hex_bench()
+
+// Throughput suite, see suite_run()
+#define SUITE_CHUNK         4096    // Bytes per eeprom_write() / eeprom_read() of the sequential runs
+#define SUITE_RAND_READS     512    // Random reads of each size
+#define SUITE_RAND_WRITES     64    // Random writes of each size, each costs a write cycle
+#define SUITE_STRADDLE        16    // Transfers across the block boundary of each kind
+#define SUITE_ADC_FRAMES    2048
+#define SUITE_DAC_SAMPLES  16384L
+#define SUITE_PARALLEL     16384L   // Bytes written to the EEPROM while the ADC is sampled
+#define SUITE_BATCH           64    // 16 byte reads through the engine, one at a time then batched
+#define SUITE_CONFIG     0x1C000    // Small configuration records, read and written through the cache
+#define SUITE_CONFIG_LEN      12    // Bytes per record, some cross a page boundary
+#define SUITE_CONFIG_RECORDS  24
+#define SUITE_CONFIG_OPS     512    // One in four is a write
+#define SUITE_UPDATE     0x1D000    // Overlapping unaligned updates, written raw then through eeprom_update()
+#define SUITE_UPDATE_AREA    512
+#define SUITE_UPDATES         64    // 10 byte updates
+#define SUITE_LOG_LEN          8    // Bytes per record appended until the log is full
+#define CHECK_ADDR       0x1E000    // EEPROM area used by check_run()
+#define CHECK_LOG_ROUNDS      10    // Records of every key appended by check_log(), past a checkpoint
+#define CHECK_LOG_LEN          8
+#define SUITE_MOVE          8192    // Bytes moved by eeprom_move()
+#define SUITE_MOVE_SRC   0x0E000    // The move goes 4K up, overlapping itself and crossing into the upper block
+
+// Buffered serial port, see uart_init()
+#define ACIA_VECTOR        26       // 6850 ACIA is on IRQ2, level 2 autovector
+#define ACIA_RESET       0x03       // Control register: master reset
+#define ACIA_8N1         0x15       // Control register: clock / 16, 8 data bits, no parity, 1 stop bit
+#define ACIA_RX_IRQ      0x80       // Control register: interrupt when a character is received
+#define ACIA_TX_IRQ      0x20       // Control register: interrupt when the transmit register is empty
+#define UART_TX_SIZE      512       // Power of two
+#define UART_RX_SIZE     1024       // Power of two, holds a window of host link frames
+#define PROTO_TIMEOUT   (TICKS_PER_SEC / 2)     // Host link: resend unacknowledged frames after this
+
 #define PI 3141
 
+// Bus instrumentation, compiled in with -DIIC_STATS, see Stats()
+// Without it the STAT_ macros compile to nothing and the bus functions are unchanged,
+// ((void)0) keeps each one a statement so it can be the body of an if
+#define STAT_BUCKETS       16       // Latency histogram, bucket b holds 2^(b-1) to 2^b - 1
+#ifdef IIC_STATS
+#define STAT_COUNT(n, v)    (iic_stats.n += (v))
+#define STAT_START(b)       stat_start(b)
+#define STAT_STOP(b)        stat_stop(b)
+#ifdef IIC_SIM
+#define STAT_CLOCK()        ticks()     // Microseconds
+#define STAT_UNIT           "us"
+#else
+#define STAT_CLOCK()        (iic_stats.ready_spins + iic_stats.ack_spins + iic_stats.irq_spins)
+#define STAT_UNIT           "polls"     // Ticks is too coarse, time is counted in status register polls
+#endif
+#else
+#define STAT_COUNT(n, v)    ((void)0)
+#define STAT_START(b)       ((void)0)
+#define STAT_STOP(b)        ((void)0)
+#endif
+
 int Echo = 0;
+int HexBad = 0;         // Set by Get2HexDigits() when a character isn't a hex digit
+
+// Serial port rings, serviced by ACIA_ISR() once uart_init() has run
+struct ring uart_tx, uart_rx;
+unsigned char uart_tx_buf[UART_TX_SIZE], uart_rx_buf[UART_RX_SIZE];
+int uart_irq = 0;
+volatile unsigned long Ticks = 0;           // Free running time base, see ticks()
+
+#ifdef IIC_STATS
+// Bus counters, a transaction runs from the first START to the STOP
+struct iic_stats {
+    unsigned long ready_spins;      // Polls of TIP in ready() and the wave loop
+    unsigned long ack_spins;        // Polls of RxACK in wait_ack()
+    unsigned long irq_spins;        // Polls of IF in wait_interrupt()
+    unsigned long starts;           // START and repeated START conditions
+    unsigned long stops;
+    unsigned long transactions;
+    unsigned long nacks;            // Bytes the slave didn't acknowledge, including acknowledge polls
+    unsigned long bytes_out;        // Address and data bytes written
+    unsigned long bytes_in;
+    unsigned long latency_max;      // Longest transaction in STAT_UNIT
+    unsigned long latency_sum;
+    unsigned long hist[STAT_BUCKETS];
+} iic_stats;
+#endif
+
+// One OpenCores I2C core. The polled functions are passed the bus to work on and the
+// interrupt driven engine keeps its queue here, so each core runs its own transfers
+// and transfers on two cores can be in progress at once.
+struct iic_xfer;
+
+struct iic_bus {
+    int id;                             // Index in iic_buses
+    unsigned long base;                 // Register base address, used by the register macros
+    int vector;                         // Exception vector of the core's interrupt
+    long core_hz;                       // wb_clk_i of the core
+    long scl_hz;                        // SCL frequency set up in the core, see iic_set_speed()
+    struct iic_xfer *volatile head;     // Engine: descriptor in progress, queue runs to tail
+    struct iic_xfer *tail;
+    volatile int state;                 // Engine: XS_ state
+    int pos;                            // Engine: bytes of hdr+wbuf or rbuf done
+    int polls;                          // Engine: times the EEPROM NACKed the descriptor's address
+    int result;                         // Engine: status to report once the stop finishes
+    int held;                           // Engine: bus kept after the last descriptor, no speed change
+#ifdef IIC_STATS
+    int stat_open;                      // A transaction is open, it started at stat_t0
+    unsigned long stat_t0;
+#endif
+};
+
+struct iic_bus iic_buses[IIC_BUSES] = {
+    { 0, IIC0_BASE, IIC_IRQ_VECTOR, wb_clk_i, IIC_SPEED_STANDARD },
+#if IIC_BUSES > 1
+    { 1, IIC1_BASE, IIC1_IRQ_VECTOR, wb_clk_i, IIC_SPEED_STANDARD },
+#endif
+};
+
+// Device registry, the bus each slave is on, the speed it is run at and the
+// fastest SCL it is rated for. Slaves not listed are on bus 0 at IIC_SPEED_STANDARD.
+struct iic_device {
+    int slave;
+    int bus;                            // Index in iic_buses
+    long scl_hz;
+    long max_hz;
+};
+
+struct iic_device iic_devices[] = {
+    { EEPROM_ADDR_LOWER, 0,             IIC_SPEED_FAST,     IIC_SPEED_FAST },       // 24LC1025 is rated for 400kHz at Vcc >= 2.5V
+    { EEPROM_ADDR_UPPER, 0,             IIC_SPEED_FAST,     IIC_SPEED_FAST },
+    { ADCDAC_ADDR,       IIC_BUSES - 1, IIC_SPEED_STANDARD, IIC_SPEED_STANDARD },   // PCF8591 is only specified up to 100kHz
+};
+
+// Transaction descriptor for the interrupt driven engine. A descriptor addresses
+// slave, writes the hlen header bytes (e.g. an EEPROM address) then wlen bytes from
+// wbuf, then if rlen > 0 does a repeated start and reads rlen bytes into rbuf.
+// status stays XFER_PENDING until the ISR finishes it with IIC_OK or an error code,
+// then done() is called if set.
+struct iic_xfer {
+    int slave;                  // 7 bit slave address
+    unsigned char hdr[2];
+    int hlen;
+    unsigned char *wbuf;
+    int wlen;
+    unsigned char *rbuf;
+    int rlen;
+    int flags;                  // XFER_NOSTOP, XFER_CONTINUE
+    volatile int status;
+    void (*done)(struct iic_xfer *x);
+    struct iic_xfer *next;
+};
+
+// Engine states, what the last command written to CR was
+#define XS_IDLE     0
+#define XS_ADDR_W   1           // Slave address for writing
+#define XS_WRITE    2           // Data byte
+#define XS_ADDR_R   3           // Slave address for reading
+#define XS_READ     4           // Read a data byte
+#define XS_STOP     5           // Stop condition
+
+struct iic_xfer *batch_head = 0;            // Descriptors collected by iic_batch_add()
+struct iic_xfer *batch_tail = 0;
+
+// Continuous ADC acquisition, the I2C ISR fills adc_ring through two descriptors
+struct iic_xfer adc_xfer[2];
+unsigned char adc_block[2][ADC_BLOCK];
+unsigned char adc_control = ADC_CONTROL;
+unsigned char adc_ring_buf[ADC_RING_SIZE];
+struct ring adc_ring;
+volatile int adc_running = 0;
+unsigned long adc_samples = 0;              // Samples read from the PCF8591, kept or not
+unsigned long adc_errors = 0;
+
+// Compressed sensor log
+// Each block holds the first frame as base values, then the difference of every frame
+// from the one before, zigzag coded and bit packed with a width per channel picked for
+// the block. Blocks are written through io, eeprom_write() for the EEPROM.
+struct slog {
+    int start;                      // Address of the first block
+    int pages;                      // Blocks the log can hold
+    int block;                      // Next block to write or read
+    int session;                    // Tag on every block of one log, blocks left by older logs don't match
+    int (*io)(int addr, unsigned char *buf, int size);
+    int frames;                     // Frames held, or in the block being read
+    int width[SLOG_CHANNELS];       // Bits per difference
+    int pos;                        // Reader: next frame of the block
+    int next;                       // Reader: next byte of the packed differences
+    unsigned int acc;               // Reader: bits taken from the block but not used yet
+    int nbits;
+    unsigned char prev[SLOG_CHANNELS];
+    unsigned char data[SLOG_MAX_FRAMES][SLOG_CHANNELS];     // Writer: frames not yet written
+    unsigned char page[EEPROM_PAGE_SIZE];
+    unsigned long bytes;            // Bytes written or read through io
+};
+
+struct slog sensor_log;
+unsigned char slog_ram[SLOG_RAM_PAGES * EEPROM_PAGE_SIZE];
+
+// Thermistor temperature in 0.1 degrees C for counts 0, 8, 16 ... 256
+// 10k NTC to ground under a 10k pull-up, count = 256 * Rt / (Rt + 10k), with the Steinhart-Hart
+// coefficients A = 1.009249522e-3, B = 2.378405444e-4, C = 2.019202697e-7. The end points are
+// worked out at counts 1 and 255. Regenerate with therm_float() if the parts change.
+const short therm_table[SENSOR_POINTS] = {
+     2554,  1397,  1098,   934,   822,   735,   664,   604,   551,   504,   460,
+      420,   383,   347,   312,   279,   247,   215,   183,   152,   120,    88,
+       55,    20,   -16,   -54,   -96,  -142,  -195,  -259,  -342,  -471,  -796
+};
+
+// Photo resistor light level in lux for counts 0, 8, 16 ... 256
+// Same divider as the thermistor, R = 10k at 10 lux with gamma 0.7, see lux_float()
+const unsigned short lux_table[SENSOR_POINTS] = {
+    27410,  1351,   479,   256,   161,   111,    81,    62,    48,    38,    31,
+       25,    21,    17,    14,    12,    10,     8,     7,     6,     5,     4,
+        3,     3,     2,     2,     1,     1,     1,     0,     0,     0,     0
+};
+
+// Filter state for one channel
+struct filter {
+    int type;                       // FILTER_MOVING, FILTER_IIR or FILTER_FIR
+    int taps;                       // Samples averaged, or FIR length
+    int shift;                      // IIR smoothing, alpha = 1 / 2^shift
+    const short *coef;              // FIR coefficients in Q15, summing to 32768 for unity gain
+    int decimate;                   // One output per decimate inputs
+    int phase;                      // Inputs since the last output
+    long acc;                       // Moving sum, or IIR output in Q8
+    int pos;                        // Next slot of hist
+    int hist[2 * FILTER_MAX_TAPS];  // Last taps inputs, stored twice so the FIR never wraps
+};
+
+// 15 tap low pass, cutoff 0.1 of the sample rate, Hamming window
+const short fir_lowpass[15] = {
+    -118, -133, 0, 696, 2205, 4257, 6075, 6804, 6075, 4257, 2205, 696, 0, -133, -118
+};
+
+struct filter adc_filters[ADC_FRAME];
+
+// One period of the DAC waveform
+unsigned char wave_table[WAVE_SIZE];
+
+// First quarter of a sine wave, amplitude 127
+const unsigned char sine_quarter[65] = {
+      0,   3,   6,   9,  12,  16,  19,  22,  25,  28,  31,  34,  37,
+     40,  43,  46,  49,  51,  54,  57,  60,  63,  65,  68,  71,  73,
+     76,  78,  81,  83,  85,  88,  90,  92,  94,  96,  98, 100, 102,
+    104, 106, 107, 109, 111, 112, 113, 115, 116, 117, 118, 120, 121,
+    122, 122, 123, 124, 125, 125, 126, 126, 126, 127, 127, 127, 127
+};
+
+// Write-back cache of EEPROM pages, see cache_read()/cache_write()
+struct cache_line {
+    int page;                   // EEPROM address of the page held, -1 if empty
+    int dirty;                  // Data differs from the EEPROM
+    unsigned long used;         // cache_clock when last used, for LRU eviction
+    unsigned char data[EEPROM_PAGE_SIZE];
+};
+
+struct cache_line cache[CACHE_LINES];
+unsigned long cache_clock = 0;
+unsigned long cache_hits = 0, cache_misses = 0, cache_flushes = 0;
+
+// Pending partial page updates, see eeprom_update()
+struct update_page {
+    int page;                   // EEPROM address of the page, -1 if free
+    unsigned char data[EEPROM_PAGE_SIZE];
+    unsigned char mask[EEPROM_PAGE_SIZE / 8];  // Bit set for each byte of data to be written
+};
+
+struct update_page updates[UPDATE_PAGES];
+unsigned long eeprom_write_cycles = 0;      // Page writes issued by eeprom_write()
+
+// Log page layout:
+//   [LOG_MAGIC][seq high][seq low][count] [key][len] x count, then the data of each record
+// Pages are written whole at log_head and the ring is reclaimed at log_tail, so every
+// page is rewritten once per trip round the ring. A record's sequence number is its
+// page sequence << 6 plus its position in the page.
+struct log_entry {
+    int page;                   // Log page of the newest record with this key, LOG_NONE or LOG_PENDING
+    int offset;                 // Offset of the data in the page (in log_data while pending)
+    int len;
+    unsigned long seq;
+};
+
+struct log_entry log_index[LOG_KEYS];
+int log_head, log_tail, log_used;           // Next page to write, oldest page in use, pages in use
+unsigned int log_seq;                       // Sequence number of the page at log_head
+unsigned char log_dir[EEPROM_PAGE_SIZE];    // Directory of the page being built
+unsigned char log_data[EEPROM_PAGE_SIZE];   // Record data of the page being built
+int log_count, log_fill;                    // Records and data bytes in the page being built
+unsigned int log_cp_seq;                    // Sequence number of the newest checkpoint
+int log_cp_due;                             // Log pages written since the last checkpoint
+unsigned long eeprom_bytes_read = 0;        // Bytes read by eeprom_read_stream()
+
+// The 24LC1025 keeps one internal address counter, the block bit included, which a read
+// leaves at the byte after the last one read. While eeprom_ptr holds it a read starting
+// there needs only the control byte (a current-address read), not the dummy write with
+// the address. Anything that may leave the counter somewhere else sets it to -1.
+long eeprom_ptr = -1;
+unsigned long eeprom_current_reads = 0;     // Reads started without the address bytes
 // Function Prototypes
 int Get2HexDigits(char *CheckSumPtr);
 int Get4HexDigits(char *CheckSumPtr);
 int Get6HexDigits(char *CheckSumPtr);
 int Get8HexDigits(char *CheckSumPtr);
 void wait_interrupt();
-char xtod(int c);
+int xtod(int c);
 int _getch( void );
+unsigned long ticks(void);
+struct iic_bus;
+void stat_start(struct iic_bus *bus);
+void stat_stop(struct iic_bus *bus);
 
 /******************************************************************************************************************************
 * Functions used to get different amounts of HEX digits
@@ -47,31 +434,83 @@ int Get2HexDigits(char *CheckSumPtr)
     register int i;
     
     Echo = 1;
-    i = (xtod(_getch()) << 4) | (xtod(_getch())); 
+    i = xtod(_getch()) << 4;
+    i |= xtod(_getch());
     Echo = 0;
+    if(i < 0)               // Either character wasn't a hex digit
+    {
+        HexBad = 1;
+        return -1;
+    }
     if(CheckSumPtr)
         *CheckSumPtr += i ;
 
     return i ;
 }
 
+// The digits must be read in order, so the high part is read into i first
 int Get4HexDigits(char *CheckSumPtr)
 {
-    return (Get2HexDigits(CheckSumPtr) << 8) | (Get2HexDigits(CheckSumPtr));
+    register int i = Get2HexDigits(CheckSumPtr) << 8;
+
+    return i | Get2HexDigits(CheckSumPtr);
 }
 
 int Get6HexDigits(char *CheckSumPtr)
 {
-    return (Get4HexDigits(CheckSumPtr) << 8) | (Get2HexDigits(CheckSumPtr));
+    register int i = Get4HexDigits(CheckSumPtr) << 8;
+
+    return i | Get2HexDigits(CheckSumPtr);
 }
 
 int Get8HexDigits(char *CheckSumPtr)
 {
-    return (Get4HexDigits(CheckSumPtr) << 16) | (Get4HexDigits(CheckSumPtr));
+    register int i = Get4HexDigits(CheckSumPtr) << 16;
+
+    return i | Get4HexDigits(CheckSumPtr);
 }
 
 
-char xtod(int c)
+//=====================================================================================
+// Hex digit lookup tables
+// hex_table gives the value of each character, -1 if it isn't a hex digit, so a digit is
+// converted with one load and a bad one can be caught by OR-ing several lookups together
+// and testing the sign once. hex_digits is the reverse, for the formatters.
+//=====================================================================================
+const signed char hex_table[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+const char hex_digits[] = "0123456789ABCDEF";
+
+//===================================================
+// Method to convert a hex digit, -1 if c isn't one
+//===================================================
+int xtod(int c)
+{
+    return hex_table[c & 0xFF];
+}
+
+//===================================================
+// The original compare and subtract conversion,
+// kept as the reference for hex_bench()
+//===================================================
+char xtod_subtract(int c)
 {
     if ((char)(c) <= (char)('9'))
         return c - (char)(0x30);    // 0 - 9 = 0x30 - 0x39 so convert to number by sutracting 0x30
@@ -81,9 +520,80 @@ char xtod(int c)
         return c - (char)(0x37);    // A-F = 0x41-46 so needs to be converted to 0x0A - 0x0F so subtract 0x37
 }
 
+//=====================================================================
+// Method to decode bytes pairs of hex digits from s into out
+// Four bytes are converted per step and checked once: a bad character
+// looks up as -1, which sets the sign of the OR of the step's values.
+// The characters are loaded singly as the 68000 can't read a word from
+// an odd address. Returns bytes, or -1 if s holds a non hex character.
+//=====================================================================
+int hex_decode(const char *s, unsigned char *out, int bytes)
+{
+    const unsigned char *p = (const unsigned char *)s;
+    int i, a, b, c, d, bad = 0;
+
+    for(i = 0; i + 4 <= bytes; i += 4, p += 8)
+    {
+        a = (hex_table[p[0]] << 4) | hex_table[p[1]];
+        b = (hex_table[p[2]] << 4) | hex_table[p[3]];
+        c = (hex_table[p[4]] << 4) | hex_table[p[5]];
+        d = (hex_table[p[6]] << 4) | hex_table[p[7]];
+        bad |= a | b | c | d;
+        out[i] = a;
+        out[i + 1] = b;
+        out[i + 2] = c;
+        out[i + 3] = d;
+    }
+    for(; i < bytes; i++, p += 2)
+    {
+        a = (hex_table[p[0]] << 4) | hex_table[p[1]];
+        bad |= a;
+        out[i] = a;
+    }
+    return bad < 0 ? -1 : bytes;
+}
+
+//=====================================================================
+// Method to format one line of a hex dump into out
+// Writes a newline, the 5 digit address, a colon and " XX" for each of
+// the n bytes, at most HEX_LINE_MAX characters. Returns the length.
+//=====================================================================
+int hex_format_line(char *out, long addr, unsigned char *buf, int n)
+{
+    char *p = out;
+    int i;
+
+    *p++ = '\n';
+    *p++ = hex_digits[(addr >> 16) & 0x1];
+    *p++ = hex_digits[(addr >> 12) & 0xF];
+    *p++ = hex_digits[(addr >> 8) & 0xF];
+    *p++ = hex_digits[(addr >> 4) & 0xF];
+    *p++ = hex_digits[addr & 0xF];
+    *p++ = ':';
+    for(i = 0; i < n; i++)
+    {
+        *p++ = ' ';
+        *p++ = hex_digits[buf[i] >> 4];
+        *p++ = hex_digits[buf[i] & 0xF];
+    }
+    return p - out;
+}
+
 int _getch( void )
 {
     int c ;
+    unsigned char ch;
+
+    if(uart_irq)
+    {
+        while(!ring_get(&uart_rx, &ch, 1))
+            CPU_IDLE();
+        c = ch & 0x7f;
+        if(Echo)
+            _putch(c);
+        return c;
+    }
+
     while(((char)(RS232_Status) & (char)(0x01)) != (char)(0x01))    // wait for Rx bit in 6850 serial comms chip status register to be '1'
         ;
 
@@ -96,91 +606,275 @@ int _getch( void )
     return c ;
 }
 
-int _putch( int c)
+//=====================================================================
+// Method to send an 8 bit character
+// With uart_init() done it only waits if the transmit ring is full,
+// ACIA_ISR() sends the characters
+//=====================================================================
+void uart_putc(int c)
 {
+    unsigned char ch = c;
+
+    if(uart_irq)
+    {
+        while(ring_free(&uart_tx) == 0)
+            CPU_IDLE();
+        ring_put(&uart_tx, &ch, 1);
+        RS232_Control = ACIA_8N1 | ACIA_RX_IRQ | ACIA_TX_IRQ;
+        return;
+    }
+
     while((RS232_Status & (char)(0x02)) != (char)(0x02))    // wait for Tx bit in status register or 6850 serial comms chip to be '1'
         ;
+    RS232_TxData = ch;
+}
+
+//=====================================================================
+// Method to receive an 8 bit character, no echo
+// Returns -1 if nothing arrives within timeout ticks
+//=====================================================================
+int uart_getc(unsigned long timeout)
+{
+    unsigned long start = ticks();
+    unsigned char ch;
+
+    while(1)
+    {
+        if(uart_irq)
+        {
+            if(ring_get(&uart_rx, &ch, 1))
+                return ch;
+        }
+        else if(((char)(RS232_Status) & (char)(0x01)) == (char)(0x01))
+            return RS232_RxData & 0xFF;
+        if(ticks() - start >= timeout)
+            return -1;
+        CPU_IDLE();
+    }
+}
+
+int _putch( int c)
+{
+    uart_putc(c & (char)(0x7f));        // mask off bit 8 to keep it 7 bit ASCII
+    return c ;                          // putchar() expects the character to be returned
+}
+
+//===================================================
+// Method to send len characters without printf()
+//===================================================
+void uart_write(char *s, int len)
+{
+    int i;
+
+    for(i = 0; i < len; i++)
+        uart_putc(s[i]);
+}
 
-    RS232_TxData = (c & (char)(0x7f));                      // write to the data register to output the character (mask off bit 8 to keep it 7 bit ASCII)
-    return c ;                                              // putchar() expects the character to be returned
+//=====================================================================
+// Method to check for a key without waiting for one
+// The key isn't taken, _getch() still returns it
+//=====================================================================
+int kbhit(void)
+{
+    if(uart_irq)
+        return ring_used(&uart_rx) != 0;
+    return ((char)(RS232_Status) & (char)(0x01)) == (char)(0x01);
 }
 
 //=================================
 // Method to initialize the IIC controller
 //=================================
-void init_iic(void)
+void init_iic(struct iic_bus *bus)
+{
+    PRERlo(bus) = prescale & 0x00FF;   // Prescale clock lower bits
+    PRERhi(bus) = (prescale & 0xFF00) >> 8;   // Prescale clock lower bits
+    bus->scl_hz = bus->core_hz / (5 * (prescale + 1));
+}
+
+void en_iic(struct iic_bus *bus)
 {
-    PRERlo = prescale & 0x00FF;   // Prescale clock lower bits
-    PRERhi = (prescale & 0xFF00) >> 8;   // Prescale clock lower bits
+    CTR(bus) = 0x80;  // 0b1000 0000 Set enable to 1, interrupt to 0
 }
 
-void en_iic(void)
+//===================================================
+// Method to get the bus a slave is on, see iic_devices
+//===================================================
+struct iic_bus *iic_slave_bus(int slave)
 {
-    CTR = 0x80;  // 0b1000 0000 Set enable to 1, interrupt to 0
+    int i;
+
+    for(i = 0; i < sizeof(iic_devices) / sizeof(iic_devices[0]); i++)
+        if(iic_devices[i].slave == slave)
+            return &iic_buses[iic_devices[i].bus];
+    return &iic_buses[0];
 }
 
 //=================================
 // Method to wait until TIP bit is 1, end of transmission
 //=================================
-int ready(void)
+int ready(struct iic_bus *bus)
 {
     // Check TIP bit 1 to see transmission has finished
-    while ((SR & 0x02) == 0x02) //0x02 = 0b00000010
-    {}
+    while ((SR(bus) & 0x02) == 0x02) //0x02 = 0b00000010
+    {
+        STAT_COUNT(ready_spins, 1);
+    }
     return 1;
 }
 
 //=================================
 // Method to wait for acknowledge back from slave
 //=================================
-void wait_ack(void) // Must be done after every write
+void wait_ack(struct iic_bus *bus) // Must be done after every write
 {
     int i = 0;
     // Poll ack bit
-    while((SR & 0x80) == 0x80){}
+    while((SR(bus) & 0x80) == 0x80)
+    {
+        STAT_COUNT(ack_spins, 1);
+    }
 }
 
 //=======================================================================
 // Method to poll IF bit until there is a valid byte in the RXR register
 //=======================================================================
-void wait_interrupt()
+void wait_interrupt(struct iic_bus *bus)
 {
     int i = 0;
-    while((SR & 0x1) == 0) {
+    while((SR(bus) & 0x1) == 0) {
         // Wait for IF bit to be 1 indicating we have a valid byte in the RXR register
+        STAT_COUNT(irq_spins, 1);
     }
 }
 
+//=====================================================================
+// Method to work out the prescale value for an SCL frequency
+// Rounds so the SCL frequency never exceeds scl_hz (see p4 of the IIC manual).
+// Returns the prescale value or IIC_ERR_RANGE if it can't be done.
+//=====================================================================
+long iic_prescale(long core_hz, long scl_hz)
+{
+    long pre;
+
+    if(core_hz <= 0 || scl_hz <= 0 || scl_hz > IIC_SPEED_FAST_PLUS)
+        return IIC_ERR_RANGE;
+
+    pre = (core_hz + 5 * scl_hz - 1) / (5 * scl_hz) - 1;
+    if(pre < 0 || pre > 0xFFFF)
+        return IIC_ERR_RANGE;
+    return pre;
+}
+
+//===================================================
+// Method to get the SCL frequency a prescale value gives
+//===================================================
+long iic_effective_hz(long core_hz, long pre)
+{
+    return core_hz / (5 * (pre + 1));
+}
+
+//=====================================================================================
+// Method to change the SCL frequency at runtime
+// The prescale registers can only be changed with the core disabled, so this waits for
+// the bus to go idle, clears EN, writes PRERlo/PRERhi and restores CTR (EN and IEN).
+// Returns IIC_OK, IIC_ERR_RANGE for a frequency the core can't make, or IIC_ERR_BUSY.
+//=====================================================================================
+int iic_set_speed(struct iic_bus *bus, long scl_hz)
+{
+    long pre;
+    int i, ctr;
+
+    pre = iic_prescale(bus->core_hz, scl_hz);
+    if(pre < 0)
+        return IIC_ERR_RANGE;
+
+    ready(bus);
+    for(i = 0; SR(bus) & 0x40; i++)     // Wait for BUSY to clear
+        if(i >= BUS_FREE_LIMIT)
+            return IIC_ERR_BUSY;
+
+    ctr = CTR(bus);
+    CTR(bus) = ctr & ~0x80;
+    PRERlo(bus) = pre & 0x00FF;
+    PRERhi(bus) = (pre & 0xFF00) >> 8;
+    CTR(bus) = ctr;
+
+    bus->scl_hz = iic_effective_hz(bus->core_hz, pre);
+    return IIC_OK;
+}
+
+//===================================================
+// Method to get the SCL frequency profile of a slave
+//===================================================
+long iic_slave_speed(int slave)
+{
+    int i;
+
+    for(i = 0; i < sizeof(iic_devices) / sizeof(iic_devices[0]); i++)
+        if(iic_devices[i].slave == slave)
+            return iic_devices[i].scl_hz;
+    return IIC_SPEED_STANDARD;
+}
+
+//===================================================
+// Method to get the fastest SCL frequency a slave is rated for
+//===================================================
+long iic_slave_max_speed(int slave)
+{
+    int i;
+
+    for(i = 0; i < sizeof(iic_devices) / sizeof(iic_devices[0]); i++)
+        if(iic_devices[i].slave == slave)
+            return iic_devices[i].max_hz;
+    return IIC_SPEED_STANDARD;
+}
+
+//=====================================================================
+// Method to switch a slave's bus to its speed before addressing it
+// Only call this when the bus is free (before a start, not a repeated start)
+//=====================================================================
+void iic_select_speed(int slave)
+{
+    struct iic_bus *bus = iic_slave_bus(slave);
+    long hz = iic_slave_speed(slave);
+
+    if(iic_effective_hz(bus->core_hz, iic_prescale(bus->core_hz, hz)) != bus->scl_hz)
+        iic_set_speed(bus, hz);
+}
+
 //===================================================
 // Method to send Write commands to the slave device
 //===================================================
-void send(int data, int ctl) // Write data
+void send(struct iic_bus *bus, int data, int ctl) // Write data
 {
     // Wait until device is ready
-    ready();
+    ready(bus);
 
     // Put address or data into TX register
-    TXR = data & 0xFF;
+    TXR(bus) = data & 0xFF;
+    STAT_COUNT(bytes_out, 1);
     if (ctl == STA)
     {
         // Generate start if needed
-        CR = 0x80 + 0x10;   // Start cond and write mode
+        STAT_START(bus);
+        CR(bus) = 0x80 + 0x10;   // Start cond and write mode
     }
     else
     {
         // Set WR bit
-        CR = 0x10;    // write mode
+        CR(bus) = 0x10;    // write mode
     }
     // Wait until device is ready
-    ready();
+    ready(bus);
 
-    wait_ack(); // Wait for slave to ack
+    wait_ack(bus); // Wait for slave to ack
 
     // Clear IACK bit
     // Generate stop if needed
     if(ctl == STO)
     {
-        CR = 0x41;
+        CR(bus) = 0x41;
+        STAT_STOP(bus);
     }
 
 }
@@ -188,469 +882,2933 @@ void send(int data, int ctl) // Write data
 // ======================================================================================
 // Method used for page read, set ACK bit to notify slave when we are still wanting data
 // ======================================================================================
-char page_ack(int ctl)  
+char page_ack(struct iic_bus *bus, int ctl)  
 {
     int data;
 
-    CR = 0x21;       // Set READ bit (Bit 5), ACK bit = 0, Clear interrupts with IACK = 1 (Bit 0)
+    CR(bus) = 0x21;  // Set READ bit (Bit 5), ACK bit = 0, Clear interrupts with IACK = 1 (Bit 0)
 
     // We need to wait for IF to be 1, meaning there is data in the RXR register
-    wait_interrupt();
-    data = RXR;       // Get Data from register
+    wait_interrupt(bus);
+    data = RXR(bus);  // Get Data from register
+    STAT_COUNT(bytes_in, 1);
 
     // We are done doing a page read
     if(ctl ==NACK) {
-        CR = 0x69;       // Set Stop bit, Read bit, IACK bit, and NACK bit
+        CR(bus) = 0x69;  // Set Stop bit, Read bit, IACK bit, and NACK bit
+        STAT_STOP(bus);
     }
     return data;
 }
 
-//===================================================
-// Method to select block of EEPROM
-//===================================================
-void selectBlock(int addr)
+//===================================================================
+// Method to send a byte and return 1 if the slave acknowledged it
+// Unlike send() this does not spin on RxACK, so a NACK can be handled
+//===================================================================
+int send_check(struct iic_bus *bus, int data, int ctl)
 {
-    if(addr > 0xFFFF)   // Upper block select, B = 1
+    // Wait until device is ready
+    ready(bus);
+
+    TXR(bus) = data & 0xFF;
+    STAT_COUNT(bytes_out, 1);
+    if (ctl == STA)
     {
-        printf("\n----- Sending slave address upper block ---\n");
-        send(((EEPROM_ADDR_UPPER<<1) + 0), STA); //Need to put 0 at end of address for a write
+        STAT_START(bus);
+        CR(bus) = 0x90;      // Start cond and write mode
     }
-    else                // Lower block select, B = 0
+    else if (ctl == STO)
+        CR(bus) = 0x50;      // Write mode and stop cond after the byte
+    else
+        CR(bus) = 0x10;      // Write mode
+
+    ready(bus);
+    if(ctl == STO)
+        STAT_STOP(bus);
+    if(SR(bus) & 0x80)          // RxACK = 1 when the slave didn't acknowledge
     {
-        printf("\n----- Sending slave address lower block ---\n");
-        send(((EEPROM_ADDR_LOWER<<1) + 0), STA); //Need to put 0 at end of address for a write
+        STAT_COUNT(nacks, 1);
+        return 0;
     }
+    return 1;
+}
 
-    // Send address (bits 15-8)
-    send((addr & 0xFF00) >> 8, NOP);
-    // Send address (bits 7-0)
-    send(addr & 0x00FF, NOP);
+//===================================================================
+// Method to read a byte from the slave
+// ACK asks the slave for another byte, NACK ends the read with a stop
+//===================================================================
+int receive(struct iic_bus *bus, int ctl)
+{
+    if(ctl == NACK)
+        CR(bus) = 0x69;      // Set READ, NACK, STOP and IACK bits
+    else
+        CR(bus) = 0x21;      // Set READ and IACK bits, ACK bit = 0
+
+    // Wait for IF to be 1, meaning there is data in the RXR register
+    wait_interrupt(bus);
+    STAT_COUNT(bytes_in, 1);
+    if(ctl == NACK)
+        STAT_STOP(bus);
+    return RXR(bus);
+}
 
-    printf("\nEnd of selectBlock\n");
+//=====================================================================================
+// Method to acknowledge poll the EEPROM
+// While the EEPROM is busy with an internal write cycle it NACKs its control byte, so
+// keep sending START + control byte until it ACKs. The next operation can then start
+// as soon as the write cycle ends instead of after a fixed delay.
+//=====================================================================================
+int ack_poll(struct iic_bus *bus, int control)
+{
+    int polls = 0;
+
+    iic_select_speed(control >> 1);
+    while(!send_check(bus, control, STA))
+    {
+        if(++polls >= ACK_POLL_LIMIT)
+        {
+            CR(bus) = 0x40;      // Release the bus
+            STAT_STOP(bus);
+            return IIC_ERR_BUSY;
+        }
+    }
+    return IIC_OK;
 }
 
+#ifndef IIC_HOSTED
 //===================================================
-// Method to send Write a byte to EEprom
+// Method to install an exception handler in the vector table in RAM
 //===================================================
-void write_byte(int addr, int data)
+void InstallExceptionHandler(void (*function_ptr)(), int level)
 {
-    // Write slaveaddress with start bit
-    selectBlock(addr);
-    // Write byte with stop bit
-    send(data, STO);
+    volatile long int *RamVectorAddress = (volatile long int *)(StartOfExceptionVectorTable);
 
+    RamVectorAddress[level] = (long int)(function_ptr);
 }
+#endif
+
+//=====================================================================
+// 6850 ACIA interrupt service routine
+// Moves received characters into uart_rx and sends from uart_tx. The
+// transmit interrupt is turned off when uart_tx runs dry, _putch()
+// turns it back on.
+//=====================================================================
+void ACIA_ISR(void)
+{
+    unsigned char status = RS232_Status, c;
 
+    if(status & 0x01)
+    {
+        c = RS232_RxData;
+        ring_put(&uart_rx, &c, 1);      // Dropped and counted in overflows if nobody is reading
+    }
+    if(status & 0x02)
+    {
+        if(ring_get(&uart_tx, &c, 1))
+            RS232_TxData = c;
+        else
+            RS232_Control = ACIA_8N1 | ACIA_RX_IRQ;
+    }
+}
 
 //===================================================
-// Method to send Write mutiple bytes to EEProm
+// Method to switch the serial port to interrupt driven rings
 //===================================================
-void write_page(int addr, int size, int data, int blockSelect)
+void uart_init(void)
 {
-    int i = 0;
-    int j;
-    int sizeBlock0, sizeBlock1;
-    int upperData, lowerData, maxWriteSize, writeOperations, remainder;
-    // Write slaveaddress with start bit
-    selectBlock(addr);
+    ring_init(&uart_tx, uart_tx_buf, UART_TX_SIZE);
+    ring_init(&uart_rx, uart_rx_buf, UART_RX_SIZE);
+    InstallExceptionHandler(ACIA_ISR, ACIA_VECTOR);
+    RS232_Control = ACIA_RESET;
+    RS232_Control = ACIA_8N1 | ACIA_RX_IRQ;
+    uart_irq = 1;
+}
 
-    printf("Inside write page. \nAddress is %#X\nData is %#X\n", addr, data);
+//===================================================
+// Method to wait until everything written has been sent
+//===================================================
+void uart_flush(void)
+{
+    while(uart_irq && ring_used(&uart_tx))
+        CPU_IDLE();
+    while((RS232_Status & (char)(0x02)) != (char)(0x02))
+        ;
+}
 
-    // If address straddles a 64K boundary, we will need to split the page write into 2 operations
-    // One for addresses 0x00000 - 0x0FFFF and one for addresses 0x10000 - 0x1FFFF
-    if(blockSelect == 2) {
+//===================================================
+// Timer 1 interrupt service routine, counts Ticks
+//===================================================
+void Timer_ISR(void)
+{
+#ifndef IIC_HOSTED
+    if(Timer1Status == 1)       // Did Timer 1 produce the interrupt?
+    {
+        Timer1Control = 3;      // Reset the timer to clear the interrupt, enable interrupts and keep counting
+        Ticks++;
+    }
+#endif
+}
 
-        sizeBlock0 = 0x10000 - addr;        // Get number of bytes in lower 64K bytes memory block (Block 0): = Boundary - start address
-        sizeBlock1 = size - sizeBlock0;     // Get number of bytes in upper 64K bytes memory block (Block 1): = data size - sizeBlock0
+//===================================================
+// Method to start the Ticks time base
+//===================================================
+void timer_init(void)
+{
+#ifndef IIC_HOSTED
+    InstallExceptionHandler(Timer_ISR, TIMER_VECTOR);
+    Timer1Data = TIMER1_RELOAD;
+    Timer1Control = 3;          // Bit0 = 1 enable interrupt, Bit1 = 1 let it count
+#endif
+}
 
-        printf("\n ---- Block 0 memory values ----\n");
-        // Write data to memory Block0
-        for(i = 0; i < sizeBlock0 - 1; i++)
-        {
+//===================================================
+// Method to read the time base, TICKS_PER_SEC per second
+//===================================================
+unsigned long ticks(void)
+{
+#ifdef IIC_HOSTED
+    return HOST_TICKS();
+#else
+    return Ticks;
+#endif
+}
 
-                printf("Writing %#02X to lower address %X\n", data + i, addr + i);
-            send(data + i, NOP);
-        }
+//=====================================================================
+// Method to work out a rate per second from a count over some ticks
+// Scales both down first so count * TICKS_PER_SEC can't overflow
+//=====================================================================
+unsigned long per_sec(unsigned long count, unsigned long elapsed)
+{
+    while(count > 0x7FFFFFFFUL / TICKS_PER_SEC)
+    {
+        count >>= 1;
+        elapsed >>= 1;
+    }
+    return elapsed ? count * TICKS_PER_SEC / elapsed : 0;
+}
 
-        // Write last byte of data to Block 0 with stop, i == sizeBlock0 - 1
-        send(data + i, STO);
+#ifdef IIC_STATS
+//===================================================
+// Method to count a START, opens a transaction
+// unless this is a repeated START inside one
+//===================================================
+void stat_start(struct iic_bus *bus)
+{
+    iic_stats.starts++;
+    if(!bus->stat_open)
+    {
+        bus->stat_open = 1;
+        bus->stat_t0 = STAT_CLOCK();
+    }
+}
 
-                printf("Writing %#02X to lower address %X\n", data + i, addr + i);
+//===================================================
+// Method to count a STOP and put the latency of the
+// transaction it ends in the histogram
+//===================================================
+void stat_stop(struct iic_bus *bus)
+{
+    unsigned long t;
+    int b = 0;
+
+    iic_stats.stops++;
+    if(!bus->stat_open)
+        return;
+    bus->stat_open = 0;
+    t = STAT_CLOCK() - bus->stat_t0;
+    iic_stats.transactions++;
+    iic_stats.latency_sum += t;
+    if(t > iic_stats.latency_max)
+        iic_stats.latency_max = t;
+    while(t && b < STAT_BUCKETS - 1)
+    {
+        t >>= 1;
+        b++;
+    }
+    iic_stats.hist[b]++;
+}
+#endif
 
-        upperData = data + i + 1;   // Set data to start where last data left off
-        // Assign new address as base address of Block 1
-        addr = 0x10000;
+//===================================================
+// Method to issue the next read command of a descriptor
+// The last byte is NACKed unless a merged read continues it
+//===================================================
+void xfer_read_next(struct iic_bus *bus, struct iic_xfer *x)
+{
+    if(bus->pos < x->rlen - 1 || (x->next && (x->next->flags & XFER_CONTINUE)))
+        CR(bus) = 0x21;                                 // Read with ACK
+    else if(x->flags & XFER_NOSTOP)
+        CR(bus) = 0x29;                                 // Read with NACK
+    else
+    {
+        CR(bus) = 0x69;                                 // Read with NACK and stop
+        STAT_STOP(bus);
+    }
+}
 
-        // Select Block 1 for writing now
-        selectBlock(addr);
+//===================================================
+// Method to issue the first command of a descriptor
+//===================================================
+void xfer_begin(struct iic_bus *bus, struct iic_xfer *x)
+{
+    bus->pos = 0;
+    bus->polls = 0;
+    bus->result = IIC_OK;
+    if(x->flags & XFER_CONTINUE)
+    {
+        // The slave is still sending from the previous descriptor's read
+        bus->state = XS_READ;
+        xfer_read_next(bus, x);
+        return;
+    }
+    if(!bus->held)
+        iic_select_speed(x->slave);
+    bus->held = (x->flags & XFER_NOSTOP) != 0;
+    if(x->slave == EEPROM_ADDR_LOWER || x->slave == EEPROM_ADDR_UPPER)
+        eeprom_ptr = -1;                // Not tracked through the engine, see eeprom_ptr
+    if(x->hlen + x->wlen > 0 || x->rlen == 0)
+    {
+        TXR(bus) = x->slave << 1;       // Write mode
+        bus->state = XS_ADDR_W;
+    }
+    else
+    {
+        TXR(bus) = (x->slave << 1) + 1;      // Read only, go straight to read mode
+        bus->state = XS_ADDR_R;
+    }
+    STAT_COUNT(bytes_out, 1);
+    STAT_START(bus);
+    CR(bus) = 0x91;      // Start cond, write mode, clear IF
+}
 
-        printf("\n ---- Block 1 memory values ----\n");
-        // Write data to  memory Block 1
-        for(i = 0; i < sizeBlock1 - 1; i++)
-        {
-            //if(i%10==0)
-           // {
-                printf("Writing %#02X to upper address %X\n", upperData + i, addr + i);
-           // }
-            send(upperData + i, NOP);
-        }
+//===================================================
+// Method to finish the descriptor at the head of the queue
+//===================================================
+void xfer_finish(struct iic_bus *bus, int status)
+{
+    struct iic_xfer *x = bus->head;
 
-                printf("Writing %#02X to upper address %X\n", upperData + i, addr + i);
+    bus->head = x->next;
+    if(!bus->head)
+        bus->tail = 0;
+    x->status = status;
+    if(x->done)
+        x->done(x);
 
-        // Write last byte of data to Block 0 with stop, i == sizeBlock1 - 1
-        send(upperData + i, STO);
+    if(bus->head)
+        xfer_begin(bus, bus->head);
+    else
+    {
+        bus->state = XS_IDLE;
+        CR(bus) = 0x01;      // Clear IF
+        CTR(bus) = 0x80;     // Disable interrupts so the polled functions can use the core again
     }
-    else if(blockSelect == 3) {
-
-        sizeBlock1 = 0x20000 - addr;        // Get number of bytes in lower 64K bytes memory block (Block 0): = Boundary - start address
-        sizeBlock0 = size - sizeBlock1;     // Get number of bytes in upper 64K bytes memory block (Block 1): = data size - sizeBlock0
+}
 
-        printf("\n ---- Block 1 memory values ----\n");
-        // Write data to memory Block0
-        for(i = 0; i < sizeBlock1 - 1; i++)
-        {
+//===================================================
+// Method to end the descriptor with a stop condition
+//===================================================
+void xfer_stop(struct iic_bus *bus, int status)
+{
+    struct iic_xfer *x;
 
-            printf("Writing %#02X to upper address %X\n", data + i, addr + i);
-            send(data + i, NOP);
-        }
+    // Merged reads depend on this one, they fail with it
+    while((x = bus->head->next) && (x->flags & XFER_CONTINUE))
+    {
+        bus->head->next = x->next;
+        if(bus->tail == x)
+            bus->tail = bus->head;
+        x->status = status;
+        if(x->done)
+            x->done(x);
+    }
+    bus->result = status;
+    bus->state = XS_STOP;
+    bus->held = 0;
+    CR(bus) = 0x41;      // Stop cond, clear IF
+    STAT_STOP(bus);
+}
 
-        // Write last byte of data to Block 0 with stop, i == sizeBlock0 - 1
-        send(data + i, STO);
-        printf("Writing %#02X to upper address %X\n", data + i, addr + i);
-        lowerData = data + i + 1;   // Set data to start where last data left off
-        // Assign new address as base address of Block 1
-        addr = 0x00000;
+//=====================================================================================
+// I2C core interrupt service routine
+// Called each time IF is set on a bus, the end of one byte (or stop) of the descriptor
+// at the head of its queue. Works out the next command from its state and issues it.
+//=====================================================================================
+void iic_isr(struct iic_bus *bus)
+{
+    struct iic_xfer *x = bus->head;
+    int n;
 
-        // Select Block 1 for writing now
-        selectBlock(addr);
+    if(!x)
+    {
+        CR(bus) = 0x01;      // Spurious, clear IF
+        return;
+    }
 
-        // printf("\n ---- Block 0 memory values ----\n");
-        // Write data to  memory Block 1
-        for(i = 0; i < sizeBlock0 - 1; i++)
-        {
-            printf("Writing %#02X to lower address %X\n", lowerData + i, addr + i);
-
-            send(lowerData + i, NOP);
-        }
-
-            printf("Writing %#02X to lower address %X\n", lowerData + i, addr + i);
-
-        // Write last byte of data to Block 0 with stop, i == sizeBlock1 - 1 ###### Are we supposed to send the STOP command on the last Byte??? #################
-        send(lowerData + i, STO);
-    }
-    // Need to select new address every 128 bytes, size > 128
-    else if(blockSelect == 4) {
-        // printf(" --- Inside BlockSelect == 4 write ----");
-        for (i = 0; i < size-1; i++)
-        {
-            if(i % 0x100 == 0)
-            {
-                printf("Writing %#02X to address %X\n", data + i, addr);
-            }
-            if(addr == 0x0ffff)
+    switch(bus->state)
+    {
+        case XS_ADDR_W:
+        case XS_WRITE:
+            n = x->hlen + x->wlen;
+            if(SR(bus) & 0x80)                      // Slave NACKed
             {
-                // printf("Addr == 0x0ffff\nWriting %#02X to  address %X\n", data + i, addr);
-                send((data + i)%0x100, STO);
-
-                selectBlock(0x10000);
-
-                addr = 0x10000;
+                STAT_COUNT(nacks, 1);
+                if(bus->state == XS_ADDR_W && (x->slave == EEPROM_ADDR_LOWER || x->slave == EEPROM_ADDR_UPPER) &&
+                   ++bus->polls < ACK_POLL_LIMIT)
+                {
+                    // EEPROM busy with a write cycle, acknowledge poll with a repeated start
+                    TXR(bus) = x->slave << 1;
+                    STAT_COUNT(bytes_out, 1);
+                    STAT_START(bus);
+                    CR(bus) = 0x91;
+                }
+                else
+                    xfer_stop(bus, IIC_ERR_NACK);
             }
-            else if(addr == 0x1ffff)
+            else if(bus->pos < n)
             {
-                // printf("Addr == 0x1ffff\nWriting %#02X to  address %X\n", data + i, addr);
-                send((data + i)%0x100, STO);
-                selectBlock(0x00000);
-                addr = 0x00000;
+                // The last byte goes out without a stop, so its ACK is checked above first
+                TXR(bus) = bus->pos < x->hlen ? x->hdr[bus->pos] : x->wbuf[bus->pos - x->hlen];
+                bus->pos++;
+                bus->state = XS_WRITE;
+                CR(bus) = 0x11;
+                STAT_COUNT(bytes_out, 1);
             }
-            else if((addr + 1)%0x80 == 0 && (addr != 0x0 && addr != 0x10000))
+            else if(x->rlen > 0)
             {
-                // printf("Addr modulo 0x7F == 0\nWriting %#02X to  address %X\n", data + i, addr);
-                send((data + i)%0x100, STO);
-                addr++;
-                selectBlock(addr);
+                TXR(bus) = (x->slave << 1) + 1;
+                bus->pos = 0;
+                bus->state = XS_ADDR_R;
+                STAT_COUNT(bytes_out, 1);
+                STAT_START(bus);
+                CR(bus) = 0x91;                     // Repeated start in read mode
             }
+            else if(x->flags & XFER_NOSTOP)
+                xfer_finish(bus, IIC_OK);
             else
+                xfer_stop(bus, IIC_OK);             // Every byte acknowledged
+            break;
+
+        case XS_ADDR_R:
+            if(SR(bus) & 0x80)
             {
-                // printf("No address change\nWriting %#02X to  address %X\n", data + i, addr);
-                send((data + i)%0x100, NOP);
-                addr++;
+                STAT_COUNT(nacks, 1);
+                xfer_stop(bus, IIC_ERR_NACK);
+                break;
             }
-        }
-        send((data + i)%0x100, STO);
-        // printf("Finished writing data\n");
-        /*
-        maxWriteSize = 127;        // 128 bytes
-        writeOperations = size/0x7F;
-        remainder = size%0x7F;          // Extra bits on top of 128 byte blocks
-        sizeBlock1 = 0x20000 - addr;        // Get number of bytes in lower 64K bytes memory block (Block 0): = Boundary - start address
-        sizeBlock0 = size - sizeBlock1;     // Get number of bytes in upper 64K bytes memory block (Block 1): = data size - sizeBlock0
+            bus->state = XS_READ;
+            xfer_read_next(bus, x);
+            break;
+
+        case XS_READ:
+            x->rbuf[bus->pos++] = RXR(bus);
+            STAT_COUNT(bytes_in, 1);
+            if(bus->pos == x->rlen)
+                xfer_finish(bus, IIC_OK);
+            else
+                xfer_read_next(bus, x);
+            break;
 
-        printf("maxwritesize: %#X\nwriteops: %#X\nremainder: %#X\nsize1: %#X\nsize0: %#X\nAddr: %#X\nData: %#X", maxWriteSize, writeOperations,remainder, sizeBlock1, sizeBlock0, addr, data);
-        while(writeOperations > 0){
-        // Write 128 bytes
-            printf("\nWriting block\nAddress is %#X\nwriteOperations is %#X\n", addr, writeOperations);
-            for(i = 0; i < maxWriteSize - 1; i++)
-            {
-                if(addr == 0x0ffff)
-                {
-                    printf("Addr == 0x0ffff\nWriting %#02X to  address %X\n", data + i, addr);
-                    send(data + i, STO);
+        case XS_STOP:
+            xfer_finish(bus, bus->result);
+            break;
 
-                    selectBlock(0x10000);
+        default:
+            CR(bus) = 0x01;
+            break;
+    }
+}
 
-                    addr = 0x10000;
-                }
-                else if(addr == 0x1ffff)
-                {
-                    printf("Addr == 0x1ffff\nWriting %#02X to  address %X\n", data + i, addr);
-                    send(data + i, STO);
+//=====================================================================================
+// Method to queue a list of descriptors linked through next on the engine
+// Returns straight away, the transfers run from iic_isr() while the caller carries on.
+// Completion is seen through each status or the done callbacks. The whole list is
+// linked in with the ISR held off, so merged reads always see their successor.
+// Every descriptor in the list must be for slaves on the same bus.
+//=====================================================================================
+void iic_submit_list(struct iic_xfer *first)
+{
+    struct iic_bus *bus = iic_slave_bus(first->slave);
+    struct iic_xfer *last;
 
-                    selectBlock(0x00000);
-                    addr = 0x00000;
-                }
-                else if(addr%0x7F == 0 && addr > 0)
-                {
-                    printf("Addr modulo 0x7F == 0\nWriting %#02X to  address %X\n", data + i, addr);
-                    send(data + i, STO);
-                    printf("Sent data\nStaus register: %#X", SR);
-                    addr++;
-                    selectBlock(addr);
-                    printf("\nBlock selected\nStatus register: %#X", SR);
-                }
-                else
-                {
-                    printf("No address change\nWriting %#02X to  address %X\n", data + i, addr);
-                    send(data+i, NOP);
-                    addr++;
-                }
-            }
-            
-            send(data + i, STO);
-            printf("Writing final byte\nWriting %#02X to  address %X\n", data + i, addr);
-            data = data + i + 1;
-            addr++;
-            writeOperations--;
-            printf("\nEnd of a 128 byte write operation, Write operations left = %d, the next address is %#2X\n", writeOperations, addr);
-            if(writeOperations > 0)
-                selectBlock(addr);
-        }// End of while loop
-
-        //Write the remainder if there is any
-        if(remainder > 0) {
-            printf(" Inside the remainder bytes statement\n");
-            selectBlock(addr);
-
-            for(j = 0; j < remainder -1; j++) {
-                printf("Writing %#02X to  address %X\n", data + j, addr);
-
-                if(addr == 0x0ffff)
-                {
-                    send(data + j, STO);
+    for(last = first; ; last = last->next)
+    {
+        last->status = XFER_PENDING;
+        if(!last->next)
+            break;
+    }
 
-                    selectBlock(0x10000);
+    CTR(bus) = 0x80;     // Hold off the ISR while the queue is changed
+    if(bus->head)
+    {
+        bus->tail->next = first;
+        bus->tail = last;
+    }
+    else
+    {
+        bus->head = first;
+        bus->tail = last;
+        xfer_begin(bus, first);
+    }
+    CTR(bus) = 0xC0;     // Enable core and interrupts
+}
 
-                    addr = 0x10000;
-                }
-                else if(addr == 0x1ffff)
-                {
-                    send(data + j, STO);
+//===================================================
+// Method to queue one descriptor on the engine
+//===================================================
+void iic_submit(struct iic_xfer *x)
+{
+    x->next = 0;
+    iic_submit_list(x);
+}
 
-                    selectBlock(0x00000);
-                    addr = 0x00000;
-                }
-                else if(addr%0x7F == 0 && addr > 0)
-                {
-                    printf("Addr % 0x7F == 0\nWriting %#02X to  address %X\n", data + j, addr);
-                    send(data + j, STO);
+//=====================================================================
+// Method for a done callback to queue a descriptor again
+// Only for use inside the ISR: links x behind the descriptor in
+// progress on x's bus. Returns 0 if the queue has run dry and x wasn't queued.
+//=====================================================================
+int xfer_requeue(struct iic_xfer *x)
+{
+    struct iic_bus *bus = iic_slave_bus(x->slave);
+
+    if(!bus->tail)
+        return 0;
+    x->status = XFER_PENDING;
+    x->next = 0;
+    bus->tail->next = x;
+    bus->tail = x;
+    return 1;
+}
 
-                    addr++;
-                    selectBlock(addr);
-                }
-                else
-                {
-                    send(data+j, NOP);
-                    addr++;
-                }
+//===================================================
+// Method to wait for a descriptor to complete
+//===================================================
+int iic_wait(struct iic_xfer *x)
+{
+    while(x->status == XFER_PENDING)
+        CPU_IDLE();
+    return x->status;
+}
 
-            }
-            send(data + j, STO);
-        }// end of remainder for loop*/
-    }// end of blockSelect == 4
+//===================================================
+// Method to fill in a descriptor
+//===================================================
+void xfer_setup(struct iic_xfer *x, int slave, unsigned char *wbuf, int wlen, unsigned char *rbuf, int rlen)
+{
+    x->slave = slave;
+    x->hlen = 0;
+    x->wbuf = wbuf;
+    x->wlen = wlen;
+    x->rbuf = rbuf;
+    x->rlen = rlen;
+    x->flags = 0;
+    x->done = 0;
+    x->next = 0;
+}
 
-    else {
-        // Write all but last byte of data
-        for(i = 0; i < size - 1; i++)
-        {   
-            //if(i%10==0)
-            //{
-                printf("Writing %#02X to address %X\n", data + i, addr + i);
-            //}
-            send(data + i, NOP);
-        }
+//===================================================
+// Method to fill in a descriptor for an EEPROM access
+// Writes len bytes from buf, or reads them if read is set
+//===================================================
+void xfer_eeprom(struct iic_xfer *x, int addr, unsigned char *buf, int len, int read)
+{
+    if(read)
+        xfer_setup(x, addr > 0xFFFF ? EEPROM_ADDR_UPPER : EEPROM_ADDR_LOWER, 0, 0, buf, len);
+    else
+        xfer_setup(x, addr > 0xFFFF ? EEPROM_ADDR_UPPER : EEPROM_ADDR_LOWER, buf, len, 0, 0);
+    x->hdr[0] = (addr & 0xFF00) >> 8;
+    x->hdr[1] = addr & 0x00FF;
+    x->hlen = 2;
+}
 
-        // Write last byte of data with stop
-        printf("Writing %#02X to address %X\n", data + i, addr + i);
-        send(data + size - 1, STO);
+//===================================================
+// Method to check if a descriptor is an EEPROM read, returns its address or -1
+//===================================================
+int xfer_eeprom_read_addr(struct iic_xfer *x)
+{
+    if((x->slave != EEPROM_ADDR_LOWER && x->slave != EEPROM_ADDR_UPPER) || x->hlen != 2 || x->wlen != 0 || x->rlen <= 0)
+        return -1;
+    return (x->slave == EEPROM_ADDR_UPPER ? 0x10000 : 0) | (x->hdr[0] << 8) | x->hdr[1];
+}
+
+//===================================================
+// Method to add a descriptor to the batch
+//===================================================
+void iic_batch_add(struct iic_xfer *x)
+{
+    x->next = 0;
+    if(batch_tail)
+        batch_tail->next = x;
+    else
+        batch_head = x;
+    batch_tail = x;
+}
+
+//=====================================================================================
+// Method to submit the batch so it drains back to back
+// - An EEPROM read that starts where the previous one ends (in the same block) is
+//   merged into it: the previous read ACKs its last byte and this one just keeps
+//   reading, with no stop, start or address bytes in between.
+// - Other descriptors are chained with repeated starts instead of stop + start, except
+//   after an EEPROM write, which needs the stop to start its internal write cycle, or
+//   when the next slave runs at a different speed, which needs the bus free to change.
+// - Each run of descriptors for one bus is queued on that bus, so with the slaves on
+//   different buses (see iic_devices) the runs are transferred at the same time.
+//=====================================================================================
+void iic_batch_run(void)
+{
+    struct iic_xfer *x, *prev = 0, *run;
+    int addr, end;
+
+    if(!batch_head)
+        return;
+
+    for(x = batch_head; x; prev = x, x = x->next)
+    {
+        x->flags &= ~(XFER_NOSTOP | XFER_CONTINUE);
+        if(!prev || iic_slave_bus(prev->slave) != iic_slave_bus(x->slave))
+            continue;
+
+        addr = xfer_eeprom_read_addr(x);
+        end = xfer_eeprom_read_addr(prev);
+        if(end >= 0)
+            end += prev->rlen;
+        if(addr >= 0 && addr == end && (end & 0xFFFF) != 0)
+            x->flags |= XFER_CONTINUE;
+        else if(!((prev->slave == EEPROM_ADDR_LOWER || prev->slave == EEPROM_ADDR_UPPER) && prev->wlen > 0) &&
+                iic_slave_speed(prev->slave) == iic_slave_speed(x->slave))
+            prev->flags |= XFER_NOSTOP;
     }
 
+    x = batch_head;
+    batch_head = batch_tail = 0;
+    while(x)
+    {
+        // Cut the list after the run of descriptors on x's bus
+        run = x;
+        while(x->next && iic_slave_bus(x->next->slave) == iic_slave_bus(run->slave))
+            x = x->next;
+        prev = x;
+        x = x->next;
+        prev->next = 0;
+        iic_submit_list(run);
+    }
 }
 
 //===================================================
-// Method to read a byte from EEProm
+// Interrupt handlers of each bus
 //===================================================
-int read_byte(int addr)
+void iic_isr0(void)
 {
-    int data;
+    iic_isr(&iic_buses[0]);
+}
 
-    // Write slaveaddress with start bit
-    
-    selectBlock(addr);
+#if IIC_BUSES > 1
+void iic_isr1(void)
+{
+    iic_isr(&iic_buses[1]);
+}
+#endif
+
+//===================================================
+// Method to set up the interrupt driven engine
+//===================================================
+void iic_engine_init(void)
+{
+    struct iic_bus *bus;
+
+    for(bus = iic_buses; bus < iic_buses + IIC_BUSES; bus++)
+    {
+        bus->head = bus->tail = 0;
+        bus->state = XS_IDLE;
+        bus->held = 0;
+    }
+    InstallExceptionHandler(iic_isr0, iic_buses[0].vector);
+#if IIC_BUSES > 1
+    InstallExceptionHandler(iic_isr1, iic_buses[1].vector);
+#endif
+}
 
+//===================================================
+// Method to select block of EEPROM
+//===================================================
+void selectBlock(struct iic_bus *bus, int addr)
+{
+    eeprom_ptr = -1;        // Whatever follows moves the counter, see read_byte()
     if(addr > 0xFFFF)   // Upper block select, B = 1
     {
-        send(((EEPROM_ADDR_UPPER<<1) + 1), STA); //Need to put 1 at end of address for a read
+        printf("\n----- Sending slave address upper block ---\n");
+        ack_poll(bus, (EEPROM_ADDR_UPPER<<1) + 0); //Need to put 0 at end of address for a write
     }
     else                // Lower block select, B = 0
     {
-        send(((EEPROM_ADDR_LOWER<<1) + 1), STA); //Need to put 1 at end of address for a read
+        printf("\n----- Sending slave address lower block ---\n");
+        ack_poll(bus, (EEPROM_ADDR_LOWER<<1) + 0); //Need to put 0 at end of address for a write
+    }
+
+    // Send address (bits 15-8)
+    send(bus, (addr & 0xFF00) >> 8, NOP);
+    // Send address (bits 7-0)
+    send(bus, addr & 0x00FF, NOP);
+
+    printf("\nEnd of selectBlock\n");
+}
+
+//=====================================================================
+// Method to select block of EEPROM and send the address without output
+// Used by the bulk transfer functions, returns a status code
+//=====================================================================
+int eeprom_address(struct iic_bus *bus, int addr)
+{
+    int status;
+
+    eeprom_ptr = -1;        // Set again by a read that completes
+
+    status = ack_poll(bus, ((addr > 0xFFFF ? EEPROM_ADDR_UPPER : EEPROM_ADDR_LOWER) << 1) + 0);
+    if(status != IIC_OK)
+        return status;
+
+    // Send address (bits 15-8) then address (bits 7-0)
+    if(!send_check(bus, (addr & 0xFF00) >> 8, NOP) || !send_check(bus, addr & 0x00FF, NOP))
+    {
+        CR(bus) = 0x40;      // Release the bus
+        STAT_STOP(bus);
+        return IIC_ERR_NACK;
     }
+    return IIC_OK;
+}
 
-    data = page_ack(NACK);
-    
-    return data;
+//=====================================================================================
+// Method to write a buffer to the EEPROM using full page writes
+// The data is split into chunks that never cross a 128 byte page, so a chunk never
+// crosses the 0x0FFFF/0x10000 block boundary either. Each chunk is one page write
+// started by acknowledge polling, so it begins the moment the previous write cycle ends.
+// Addresses past 0x1FFFF wrap around to 0x00000.
+//=====================================================================================
+int eeprom_write(int addr, unsigned char *buf, int size)
+{
+    struct iic_bus *bus = iic_slave_bus(EEPROM_ADDR_LOWER);
+    int i, chunk, status;
+
+    if(addr < 0 || addr > 0x1FFFF || size < 0 || size > EEPROM_SIZE)
+        return IIC_ERR_RANGE;
+
+    while(size > 0)
+    {
+        chunk = EEPROM_PAGE_SIZE - (addr & (EEPROM_PAGE_SIZE - 1));
+        if(chunk > size)
+            chunk = size;
+
+        status = eeprom_address(bus, addr);
+        if(status != IIC_OK)
+            return status;
+
+        for(i = 0; i < chunk - 1; i++)
+        {
+            if(!send_check(bus, buf[i], NOP))
+            {
+                CR(bus) = 0x40;
+                STAT_STOP(bus);
+                return IIC_ERR_NACK;
+            }
+        }
+        // Last byte of the page with stop, this starts the internal write cycle
+        if(!send_check(bus, buf[i], STO))
+            return IIC_ERR_NACK;
+        eeprom_write_cycles++;
+
+        buf += chunk;
+        size -= chunk;
+        addr = (addr + chunk) & 0x1FFFF;
+    }
+    return IIC_OK;
+}
+
+//=========================================================================
+// Method to write an incrementing data pattern using full page writes
+//=========================================================================
+void write_burst(int addr, int size, int data)
+{
+    unsigned char page[EEPROM_PAGE_SIZE];
+    int i, chunk, status;
+
+    while(size > 0)
+    {
+        chunk = EEPROM_PAGE_SIZE - (addr & (EEPROM_PAGE_SIZE - 1));
+        if(chunk > size)
+            chunk = size;
+
+        for(i = 0; i < chunk; i++)
+            page[i] = data++;
+
+        status = eeprom_write(addr, page, chunk);
+        if(status != IIC_OK)
+        {
+            printf("\nPage write at address %#X failed with status %d\n", addr, status);
+            return;
+        }
+        size -= chunk;
+        addr = (addr + chunk) & 0x1FFFF;
+    }
 }
 
 //===================================================
-// Method to read multiple bytes from EEProm
+// Method to send Write a byte to EEprom
+//===================================================
+void write_byte(int addr, int data)
+{
+    struct iic_bus *bus = iic_slave_bus(EEPROM_ADDR_LOWER);
+
+    // Write slaveaddress with start bit
+    selectBlock(bus, addr);
+    // Write byte with stop bit
+    send(bus, data, STO);
+
+}
+
+
+//===================================================
+// Method to send Write mutiple bytes to EEProm
 //===================================================
-void read_page(int addr, int size, int blockSelect)
+void write_page(int addr, int size, int data, int blockSelect)
 {
+    struct iic_bus *bus = iic_slave_bus(EEPROM_ADDR_LOWER);
     int i = 0;
-    int j = 0;
     int sizeBlock0, sizeBlock1;
-    int data;
-    // Write slaveaddress with start bit
-    selectBlock(addr);
+    int upperData, lowerData;
 
-    // Write slaveaddress with start bit
-    if(addr > 0xFFFF)   // Upper block select, B = 1
-    {
-        send(((EEPROM_ADDR_UPPER<<1) + 1), STA);
-    }
-    else                // Lower block select, B = 0
-    {
-        send(((EEPROM_ADDR_LOWER<<1) + 1), STA);
+    // Writes of a page or more go through the page aligned burst writer
+    if(blockSelect == 4) {
+        write_burst(addr, size, data);
+        return;
     }
 
+    // Write slaveaddress with start bit
+    selectBlock(bus, addr);
+
+    printf("Inside write page. \nAddress is %#X\nData is %#X\n", addr, data);
+
     // If address straddles a 64K boundary, we will need to split the page write into 2 operations
     // One for addresses 0x00000 - 0x0FFFF and one for addresses 0x10000 - 0x1FFFF
     if(blockSelect == 2) {
-        sizeBlock0 = 0x010000 - addr;        // Get number of bytes in lower 64K bytes memory block (Block 0): = Boundary - start address
+
+        sizeBlock0 = 0x10000 - addr;        // Get number of bytes in lower 64K bytes memory block (Block 0): = Boundary - start address
         sizeBlock1 = size - sizeBlock0;     // Get number of bytes in upper 64K bytes memory block (Block 1): = data size - sizeBlock0
 
         printf("\n ---- Block 0 memory values ----\n");
-        // Read data from memory Block0
+        // Write data to memory Block0
         for(i = 0; i < sizeBlock0 - 1; i++)
         {
-            data = page_ack(ACK);
-            printf("\nRead data %#02X from lower address %#X.", data, addr + i);
+
+                printf("Writing %#02X to lower address %X\n", data + i, addr + i);
+            send(bus, data + i, NOP);
         }
 
         // Write last byte of data to Block 0 with stop, i == sizeBlock0 - 1
-        data = page_ack(NACK);
-        printf("\nRead data %#02X from lower address %#X.\n", data, addr + i);
+        send(bus, data + i, STO);
+
+                printf("Writing %#02X to lower address %X\n", data + i, addr + i);
 
+        upperData = data + i + 1;   // Set data to start where last data left off
         // Assign new address as base address of Block 1
-        addr = 0x010000;
+        addr = 0x10000;
 
         // Select Block 1 for writing now
-        selectBlock(addr);
-
-        // Send slave address and READ command, and repeated start
-        send(((EEPROM_ADDR_UPPER<<1) + 1), STA);
+        selectBlock(bus, addr);
 
         printf("\n ---- Block 1 memory values ----\n");
-        // read data from memory Block 1
-        for(j = 0; j < sizeBlock1 - 1; j++)
+        // Write data to  memory Block 1
+        for(i = 0; i < sizeBlock1 - 1; i++)
         {
-            data = page_ack(ACK);
-            printf("\nRead data %#02X from upper address %#X.", data, addr + j);
+            //if(i%10==0)
+           // {
+                printf("Writing %#02X to upper address %X\n", upperData + i, addr + i);
+           // }
+            send(bus, upperData + i, NOP);
         }
 
-        // Write last byte of data to Block 0 with stop
-        data = page_ack(NACK);
-        printf("\nRead data %#02X from upper address %#X.\n", data, addr + j);
+                printf("Writing %#02X to upper address %X\n", upperData + i, addr + i);
+
+        // Write last byte of data to Block 0 with stop, i == sizeBlock1 - 1
+        send(bus, upperData + i, STO);
     }
     else if(blockSelect == 3) {
-        sizeBlock1 = 0x020000 - addr;        // Get number of bytes in lower 64K bytes memory block (Block 0): = Boundary - start address
+
+        sizeBlock1 = 0x20000 - addr;        // Get number of bytes in lower 64K bytes memory block (Block 0): = Boundary - start address
         sizeBlock0 = size - sizeBlock1;     // Get number of bytes in upper 64K bytes memory block (Block 1): = data size - sizeBlock0
 
         printf("\n ---- Block 1 memory values ----\n");
-        // Read data from memory Block0
+        // Write data to memory Block0
         for(i = 0; i < sizeBlock1 - 1; i++)
         {
-            data = page_ack(ACK);
-            printf("\nRead data %#02X from upper address %#X.", data, addr + i);
+
+            printf("Writing %#02X to upper address %X\n", data + i, addr + i);
+            send(bus, data + i, NOP);
         }
 
         // Write last byte of data to Block 0 with stop, i == sizeBlock0 - 1
-        data = page_ack(NACK);
-        printf("\nRead data %#02X from upper address %#X.\n", data, addr + i);
-
+        send(bus, data + i, STO);
+        printf("Writing %#02X to upper address %X\n", data + i, addr + i);
+        lowerData = data + i + 1;   // Set data to start where last data left off
         // Assign new address as base address of Block 1
-        addr = 0x000000;
+        addr = 0x00000;
 
         // Select Block 1 for writing now
-        selectBlock(addr);
+        selectBlock(bus, addr);
 
-        // Send slave address and READ command, and repeated start
-        send(((EEPROM_ADDR_LOWER<<1) + 1), STA);
-
-        printf("\n ---- Block 0 memory values ----\n");
-        // read data from memory Block 1
-        for(j = 0; j < sizeBlock0 - 1; j++)
+        // printf("\n ---- Block 0 memory values ----\n");
+        // Write data to  memory Block 1
+        for(i = 0; i < sizeBlock0 - 1; i++)
         {
-            data = page_ack(ACK);
-            printf("\nRead data %#02X from lower address %#X.", data, addr + j);
+            printf("Writing %#02X to lower address %X\n", lowerData + i, addr + i);
+
+            send(bus, lowerData + i, NOP);
         }
 
-        // Write last byte of data to Block 0 with stop
-        data = page_ack(NACK);
-        printf("\nRead data %#02X from lower address %#X.\n", data, addr + j);
+            printf("Writing %#02X to lower address %X\n", lowerData + i, addr + i);
+
+        // Write last byte of data to Block 0 with stop, i == sizeBlock1 - 1 ###### Are we supposed to send the STOP command on the last Byte??? #################
+        send(bus, lowerData + i, STO);
     }
     else {
+        // Write all but last byte of data
         for(i = 0; i < size - 1; i++)
-        {
-            data = page_ack(ACK);
-            printf("\nRead data 0x%X from address 0x%X.", data, addr + i);
+        {   
+            //if(i%10==0)
+            //{
+                printf("Writing %#02X to address %X\n", data + i, addr + i);
+            //}
+            send(bus, data + i, NOP);
         }
-        data = page_ack(NACK);
-        printf("\nRead data 0x%X from address 0x%X.", data, addr + i);
+
+        // Write last byte of data with stop
+        printf("Writing %#02X to address %X\n", data + i, addr + i);
+        send(bus, data + size - 1, STO);
     }
 
 }
 
 //===================================================
-// Method to display menu for EEProm chip functions
+// Method to read a byte from EEProm
 //===================================================
-void EEPROM(void)
+int read_byte(int addr)
 {
-    
-    int mode = 0, addr = 0, size = 0, data = 0, valid = 0, i = 0;
-    int endAddr, blockSelect;
+    struct iic_bus *bus = iic_slave_bus(EEPROM_ADDR_LOWER);
+    int data;
 
-    while(!valid)
+    // Write slaveaddress with start bit, unless the EEPROM's address counter is already at addr
+    if(addr != eeprom_ptr)
+        selectBlock(bus, addr);
+    else
     {
-        printf("\nPlease select a mode by entering a number. \n1: Write byte\n2: Write page\n3: Read byte\n4: Read page\n");
-        //mode = _getch();
-        scanf("%d", &mode);
-
-        if(mode > 0 && mode < 5) valid = 1;
-        else
-        {
-            printf("\nYou selected an invalid option. Please enter a number between 1 and 4.\n\n");
-        }
+        printf("\n----- Current address read, no address sent ---\n");
+        iic_select_speed(EEPROM_ADDR_LOWER);
+        eeprom_current_reads++;
+    }
+
+    if(addr > 0xFFFF)   // Upper block select, B = 1
+    {
+        send(bus, ((EEPROM_ADDR_UPPER<<1) + 1), STA); //Need to put 1 at end of address for a read
+    }
+    else                // Lower block select, B = 0
+    {
+        send(bus, ((EEPROM_ADDR_LOWER<<1) + 1), STA); //Need to put 1 at end of address for a read
+    }
+
+    data = page_ack(bus, NACK);
+    // page_ack(NACK) reads the byte, then one more with the stop, rolling over inside the block
+    eeprom_ptr = (addr & 0x10000) | ((addr + 2) & 0xFFFF);
+
+    return data;
+}
+
+//=====================================================================
+// Method to start a sequential read from the EEPROM at addr
+// Sends the dummy write with the address, then a repeated start in read
+// mode. If the address counter is already at addr (see eeprom_ptr) the
+// control byte in read mode is all that's sent.
+//=====================================================================
+int eeprom_read_start(struct iic_bus *bus, int addr)
+{
+    int control = ((addr > 0xFFFF ? EEPROM_ADDR_UPPER : EEPROM_ADDR_LOWER) << 1) + 1;
+    int status;
+
+    if(addr == eeprom_ptr)
+    {
+        eeprom_ptr = -1;
+        iic_select_speed(control >> 1);
+        if(send_check(bus, control, STA))
+        {
+            eeprom_current_reads++;
+            return IIC_OK;
+        }
+        CR(bus) = 0x40;      // NACKed, release the bus and send the address after all
+        STAT_STOP(bus);
+    }
+
+    status = eeprom_address(bus, addr);
+    if(status != IIC_OK)
+        return status;
+
+    if(!send_check(bus, control, STA))
+    {
+        CR(bus) = 0x40;      // Release the bus
+        STAT_STOP(bus);
+        return IIC_ERR_NACK;
+    }
+    return IIC_OK;
+}
+
+//=====================================================================================
+// Method to stream size bytes from the EEPROM through buf, which holds len bytes
+// Each time buf fills up chunk(addr, buf, count, arg) is called with the address of
+// the first byte in buf, and once more for any remainder at the end. With no chunk
+// function buf must hold the whole read. Nothing is printed while the bus is busy.
+// The EEPROM only rolls over inside a block, so one sequential read is done per block:
+// 0x0FFFF continues at 0x10000, and 0x1FFFF at 0x00000.
+//=====================================================================================
+int eeprom_read_stream(int addr, int size, unsigned char *buf, int len,
+                       void (*chunk)(int addr, unsigned char *buf, int len, void *arg), void *arg)
+{
+    struct iic_bus *bus = iic_slave_bus(EEPROM_ADDR_LOWER);
+    int n, status, fill = 0, start = addr, end;
+
+    if(addr < 0 || addr > 0x1FFFF || size < 0 || size > EEPROM_SIZE)
+        return IIC_ERR_RANGE;
+    if(size == 0)
+        return IIC_OK;
+    if(len < 1 || (!chunk && len < size))
+        return IIC_ERR_RANGE;
+    eeprom_bytes_read += size;
+
+    while(size > 0)
+    {
+        n = 0x10000 - (addr & 0xFFFF);
+        if(n > size)
+            n = size;
+
+        status = eeprom_read_start(bus, addr);
+        if(status != IIC_OK)
+            return status;
+
+        end = (addr & 0x10000) | ((addr + n) & 0xFFFF);    // Counter rolls over inside the block
+        size -= n;
+        addr = (addr + n) & 0x1FFFF;
+
+        while(--n > 0)
+        {
+            buf[fill++] = receive(bus, ACK);
+            if(fill == len && chunk)
+            {
+                chunk(start, buf, fill, arg);
+                start = (start + fill) & 0x1FFFF;
+                fill = 0;
+            }
+        }
+        // Last byte of this block with NACK and stop
+        buf[fill++] = receive(bus, NACK);
+        eeprom_ptr = end;
+        if(fill == len && chunk)
+        {
+            chunk(start, buf, fill, arg);
+            start = (start + fill) & 0x1FFFF;
+            fill = 0;
+        }
+    }
+    if(fill > 0 && chunk)
+        chunk(start, buf, fill, arg);
+    return IIC_OK;
+}
+
+//===================================================
+// Method to read a buffer from the EEPROM
+//===================================================
+int eeprom_read(int addr, unsigned char *buf, int size)
+{
+    return eeprom_read_stream(addr, size, buf, size, 0, 0);
+}
+
+//===================================================
+// Method to print a buffer as a hex dump, 16 bytes per line
+// Matches the chunk function of eeprom_read_stream()
+// Each line is built by hex_format_line(), not printf()
+//===================================================
+void hex_dump(int addr, unsigned char *buf, int len, void *arg)
+{
+    char line[HEX_LINE_MAX];
+    int i, n;
+
+    for(i = 0; i < len; i += HEX_LINE_BYTES)
+    {
+        n = len - i < HEX_LINE_BYTES ? len - i : HEX_LINE_BYTES;
+        uart_write(line, hex_format_line(line, addr + i, buf + i, n));
+    }
+}
+
+//===================================================
+// Method to read multiple bytes from EEProm
+// The bus is read first into a buffer, then dumped to the console
+//===================================================
+void read_page(int addr, int size)
+{
+    unsigned char buf[256];
+    int status;
+
+    status = eeprom_read_stream(addr, size, buf, sizeof(buf), hex_dump, 0);
+    uart_flush();                       // Let the dump out ahead of anything printf() sends next
+    if(status != IIC_OK)
+        printf("\nRead at address %#X failed with status %d\n", addr, status);
+}
+
+//=====================================================================================
+// CRC lookup tables
+// CRC-16/CCITT (poly 0x1021, MSB first) and CRC-32 (poly 0xEDB88320, reflected) one byte
+// at a time. Building with CRC_SLICE4 defined adds 3K of tables so CRC-32 can do four
+// bytes per step, trading ROM for speed.
+//=====================================================================================
+const unsigned short crc16_table[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+    0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+    0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+    0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+    0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+    0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+    0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+    0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+    0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+    0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+    0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+    0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+    0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+    0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+    0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+    0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+    0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+    0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+    0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+    0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+    0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+    0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+
+const unsigned long crc32_table[256] = {
+    0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
+    0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
+    0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
+    0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+    0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
+    0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
+    0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
+    0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+    0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
+    0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
+    0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
+    0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+    0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
+    0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
+    0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
+    0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+    0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
+    0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
+    0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
+    0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+    0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
+    0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
+    0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
+    0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+    0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
+    0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
+    0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
+    0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+    0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
+    0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
+    0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
+    0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+    0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
+    0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
+    0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
+    0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+    0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
+    0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
+    0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
+    0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+    0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
+    0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
+    0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
+};
+
+#ifdef CRC_SLICE4
+const unsigned long crc32_slice[3][256] = {
+    {
+        0x00000000, 0x191B3141, 0x32366282, 0x2B2D53C3, 0x646CC504, 0x7D77F445,
+        0x565AA786, 0x4F4196C7, 0xC8D98A08, 0xD1C2BB49, 0xFAEFE88A, 0xE3F4D9CB,
+        0xACB54F0C, 0xB5AE7E4D, 0x9E832D8E, 0x87981CCF, 0x4AC21251, 0x53D92310,
+        0x78F470D3, 0x61EF4192, 0x2EAED755, 0x37B5E614, 0x1C98B5D7, 0x05838496,
+        0x821B9859, 0x9B00A918, 0xB02DFADB, 0xA936CB9A, 0xE6775D5D, 0xFF6C6C1C,
+        0xD4413FDF, 0xCD5A0E9E, 0x958424A2, 0x8C9F15E3, 0xA7B24620, 0xBEA97761,
+        0xF1E8E1A6, 0xE8F3D0E7, 0xC3DE8324, 0xDAC5B265, 0x5D5DAEAA, 0x44469FEB,
+        0x6F6BCC28, 0x7670FD69, 0x39316BAE, 0x202A5AEF, 0x0B07092C, 0x121C386D,
+        0xDF4636F3, 0xC65D07B2, 0xED705471, 0xF46B6530, 0xBB2AF3F7, 0xA231C2B6,
+        0x891C9175, 0x9007A034, 0x179FBCFB, 0x0E848DBA, 0x25A9DE79, 0x3CB2EF38,
+        0x73F379FF, 0x6AE848BE, 0x41C51B7D, 0x58DE2A3C, 0xF0794F05, 0xE9627E44,
+        0xC24F2D87, 0xDB541CC6, 0x94158A01, 0x8D0EBB40, 0xA623E883, 0xBF38D9C2,
+        0x38A0C50D, 0x21BBF44C, 0x0A96A78F, 0x138D96CE, 0x5CCC0009, 0x45D73148,
+        0x6EFA628B, 0x77E153CA, 0xBABB5D54, 0xA3A06C15, 0x888D3FD6, 0x91960E97,
+        0xDED79850, 0xC7CCA911, 0xECE1FAD2, 0xF5FACB93, 0x7262D75C, 0x6B79E61D,
+        0x4054B5DE, 0x594F849F, 0x160E1258, 0x0F152319, 0x243870DA, 0x3D23419B,
+        0x65FD6BA7, 0x7CE65AE6, 0x57CB0925, 0x4ED03864, 0x0191AEA3, 0x188A9FE2,
+        0x33A7CC21, 0x2ABCFD60, 0xAD24E1AF, 0xB43FD0EE, 0x9F12832D, 0x8609B26C,
+        0xC94824AB, 0xD05315EA, 0xFB7E4629, 0xE2657768, 0x2F3F79F6, 0x362448B7,
+        0x1D091B74, 0x04122A35, 0x4B53BCF2, 0x52488DB3, 0x7965DE70, 0x607EEF31,
+        0xE7E6F3FE, 0xFEFDC2BF, 0xD5D0917C, 0xCCCBA03D, 0x838A36FA, 0x9A9107BB,
+        0xB1BC5478, 0xA8A76539, 0x3B83984B, 0x2298A90A, 0x09B5FAC9, 0x10AECB88,
+        0x5FEF5D4F, 0x46F46C0E, 0x6DD93FCD, 0x74C20E8C, 0xF35A1243, 0xEA412302,
+        0xC16C70C1, 0xD8774180, 0x9736D747, 0x8E2DE606, 0xA500B5C5, 0xBC1B8484,
+        0x71418A1A, 0x685ABB5B, 0x4377E898, 0x5A6CD9D9, 0x152D4F1E, 0x0C367E5F,
+        0x271B2D9C, 0x3E001CDD, 0xB9980012, 0xA0833153, 0x8BAE6290, 0x92B553D1,
+        0xDDF4C516, 0xC4EFF457, 0xEFC2A794, 0xF6D996D5, 0xAE07BCE9, 0xB71C8DA8,
+        0x9C31DE6B, 0x852AEF2A, 0xCA6B79ED, 0xD37048AC, 0xF85D1B6F, 0xE1462A2E,
+        0x66DE36E1, 0x7FC507A0, 0x54E85463, 0x4DF36522, 0x02B2F3E5, 0x1BA9C2A4,
+        0x30849167, 0x299FA026, 0xE4C5AEB8, 0xFDDE9FF9, 0xD6F3CC3A, 0xCFE8FD7B,
+        0x80A96BBC, 0x99B25AFD, 0xB29F093E, 0xAB84387F, 0x2C1C24B0, 0x350715F1,
+        0x1E2A4632, 0x07317773, 0x4870E1B4, 0x516BD0F5, 0x7A468336, 0x635DB277,
+        0xCBFAD74E, 0xD2E1E60F, 0xF9CCB5CC, 0xE0D7848D, 0xAF96124A, 0xB68D230B,
+        0x9DA070C8, 0x84BB4189, 0x03235D46, 0x1A386C07, 0x31153FC4, 0x280E0E85,
+        0x674F9842, 0x7E54A903, 0x5579FAC0, 0x4C62CB81, 0x8138C51F, 0x9823F45E,
+        0xB30EA79D, 0xAA1596DC, 0xE554001B, 0xFC4F315A, 0xD7626299, 0xCE7953D8,
+        0x49E14F17, 0x50FA7E56, 0x7BD72D95, 0x62CC1CD4, 0x2D8D8A13, 0x3496BB52,
+        0x1FBBE891, 0x06A0D9D0, 0x5E7EF3EC, 0x4765C2AD, 0x6C48916E, 0x7553A02F,
+        0x3A1236E8, 0x230907A9, 0x0824546A, 0x113F652B, 0x96A779E4, 0x8FBC48A5,
+        0xA4911B66, 0xBD8A2A27, 0xF2CBBCE0, 0xEBD08DA1, 0xC0FDDE62, 0xD9E6EF23,
+        0x14BCE1BD, 0x0DA7D0FC, 0x268A833F, 0x3F91B27E, 0x70D024B9, 0x69CB15F8,
+        0x42E6463B, 0x5BFD777A, 0xDC656BB5, 0xC57E5AF4, 0xEE530937, 0xF7483876,
+        0xB809AEB1, 0xA1129FF0, 0x8A3FCC33, 0x9324FD72
+    },
+    {
+        0x00000000, 0x01C26A37, 0x0384D46E, 0x0246BE59, 0x0709A8DC, 0x06CBC2EB,
+        0x048D7CB2, 0x054F1685, 0x0E1351B8, 0x0FD13B8F, 0x0D9785D6, 0x0C55EFE1,
+        0x091AF964, 0x08D89353, 0x0A9E2D0A, 0x0B5C473D, 0x1C26A370, 0x1DE4C947,
+        0x1FA2771E, 0x1E601D29, 0x1B2F0BAC, 0x1AED619B, 0x18ABDFC2, 0x1969B5F5,
+        0x1235F2C8, 0x13F798FF, 0x11B126A6, 0x10734C91, 0x153C5A14, 0x14FE3023,
+        0x16B88E7A, 0x177AE44D, 0x384D46E0, 0x398F2CD7, 0x3BC9928E, 0x3A0BF8B9,
+        0x3F44EE3C, 0x3E86840B, 0x3CC03A52, 0x3D025065, 0x365E1758, 0x379C7D6F,
+        0x35DAC336, 0x3418A901, 0x3157BF84, 0x3095D5B3, 0x32D36BEA, 0x331101DD,
+        0x246BE590, 0x25A98FA7, 0x27EF31FE, 0x262D5BC9, 0x23624D4C, 0x22A0277B,
+        0x20E69922, 0x2124F315, 0x2A78B428, 0x2BBADE1F, 0x29FC6046, 0x283E0A71,
+        0x2D711CF4, 0x2CB376C3, 0x2EF5C89A, 0x2F37A2AD, 0x709A8DC0, 0x7158E7F7,
+        0x731E59AE, 0x72DC3399, 0x7793251C, 0x76514F2B, 0x7417F172, 0x75D59B45,
+        0x7E89DC78, 0x7F4BB64F, 0x7D0D0816, 0x7CCF6221, 0x798074A4, 0x78421E93,
+        0x7A04A0CA, 0x7BC6CAFD, 0x6CBC2EB0, 0x6D7E4487, 0x6F38FADE, 0x6EFA90E9,
+        0x6BB5866C, 0x6A77EC5B, 0x68315202, 0x69F33835, 0x62AF7F08, 0x636D153F,
+        0x612BAB66, 0x60E9C151, 0x65A6D7D4, 0x6464BDE3, 0x662203BA, 0x67E0698D,
+        0x48D7CB20, 0x4915A117, 0x4B531F4E, 0x4A917579, 0x4FDE63FC, 0x4E1C09CB,
+        0x4C5AB792, 0x4D98DDA5, 0x46C49A98, 0x4706F0AF, 0x45404EF6, 0x448224C1,
+        0x41CD3244, 0x400F5873, 0x4249E62A, 0x438B8C1D, 0x54F16850, 0x55330267,
+        0x5775BC3E, 0x56B7D609, 0x53F8C08C, 0x523AAABB, 0x507C14E2, 0x51BE7ED5,
+        0x5AE239E8, 0x5B2053DF, 0x5966ED86, 0x58A487B1, 0x5DEB9134, 0x5C29FB03,
+        0x5E6F455A, 0x5FAD2F6D, 0xE1351B80, 0xE0F771B7, 0xE2B1CFEE, 0xE373A5D9,
+        0xE63CB35C, 0xE7FED96B, 0xE5B86732, 0xE47A0D05, 0xEF264A38, 0xEEE4200F,
+        0xECA29E56, 0xED60F461, 0xE82FE2E4, 0xE9ED88D3, 0xEBAB368A, 0xEA695CBD,
+        0xFD13B8F0, 0xFCD1D2C7, 0xFE976C9E, 0xFF5506A9, 0xFA1A102C, 0xFBD87A1B,
+        0xF99EC442, 0xF85CAE75, 0xF300E948, 0xF2C2837F, 0xF0843D26, 0xF1465711,
+        0xF4094194, 0xF5CB2BA3, 0xF78D95FA, 0xF64FFFCD, 0xD9785D60, 0xD8BA3757,
+        0xDAFC890E, 0xDB3EE339, 0xDE71F5BC, 0xDFB39F8B, 0xDDF521D2, 0xDC374BE5,
+        0xD76B0CD8, 0xD6A966EF, 0xD4EFD8B6, 0xD52DB281, 0xD062A404, 0xD1A0CE33,
+        0xD3E6706A, 0xD2241A5D, 0xC55EFE10, 0xC49C9427, 0xC6DA2A7E, 0xC7184049,
+        0xC25756CC, 0xC3953CFB, 0xC1D382A2, 0xC011E895, 0xCB4DAFA8, 0xCA8FC59F,
+        0xC8C97BC6, 0xC90B11F1, 0xCC440774, 0xCD866D43, 0xCFC0D31A, 0xCE02B92D,
+        0x91AF9640, 0x906DFC77, 0x922B422E, 0x93E92819, 0x96A63E9C, 0x976454AB,
+        0x9522EAF2, 0x94E080C5, 0x9FBCC7F8, 0x9E7EADCF, 0x9C381396, 0x9DFA79A1,
+        0x98B56F24, 0x99770513, 0x9B31BB4A, 0x9AF3D17D, 0x8D893530, 0x8C4B5F07,
+        0x8E0DE15E, 0x8FCF8B69, 0x8A809DEC, 0x8B42F7DB, 0x89044982, 0x88C623B5,
+        0x839A6488, 0x82580EBF, 0x801EB0E6, 0x81DCDAD1, 0x8493CC54, 0x8551A663,
+        0x8717183A, 0x86D5720D, 0xA9E2D0A0, 0xA820BA97, 0xAA6604CE, 0xABA46EF9,
+        0xAEEB787C, 0xAF29124B, 0xAD6FAC12, 0xACADC625, 0xA7F18118, 0xA633EB2F,
+        0xA4755576, 0xA5B73F41, 0xA0F829C4, 0xA13A43F3, 0xA37CFDAA, 0xA2BE979D,
+        0xB5C473D0, 0xB40619E7, 0xB640A7BE, 0xB782CD89, 0xB2CDDB0C, 0xB30FB13B,
+        0xB1490F62, 0xB08B6555, 0xBBD72268, 0xBA15485F, 0xB853F606, 0xB9919C31,
+        0xBCDE8AB4, 0xBD1CE083, 0xBF5A5EDA, 0xBE9834ED
+    },
+    {
+        0x00000000, 0xB8BC6765, 0xAA09C88B, 0x12B5AFEE, 0x8F629757, 0x37DEF032,
+        0x256B5FDC, 0x9DD738B9, 0xC5B428EF, 0x7D084F8A, 0x6FBDE064, 0xD7018701,
+        0x4AD6BFB8, 0xF26AD8DD, 0xE0DF7733, 0x58631056, 0x5019579F, 0xE8A530FA,
+        0xFA109F14, 0x42ACF871, 0xDF7BC0C8, 0x67C7A7AD, 0x75720843, 0xCDCE6F26,
+        0x95AD7F70, 0x2D111815, 0x3FA4B7FB, 0x8718D09E, 0x1ACFE827, 0xA2738F42,
+        0xB0C620AC, 0x087A47C9, 0xA032AF3E, 0x188EC85B, 0x0A3B67B5, 0xB28700D0,
+        0x2F503869, 0x97EC5F0C, 0x8559F0E2, 0x3DE59787, 0x658687D1, 0xDD3AE0B4,
+        0xCF8F4F5A, 0x7733283F, 0xEAE41086, 0x525877E3, 0x40EDD80D, 0xF851BF68,
+        0xF02BF8A1, 0x48979FC4, 0x5A22302A, 0xE29E574F, 0x7F496FF6, 0xC7F50893,
+        0xD540A77D, 0x6DFCC018, 0x359FD04E, 0x8D23B72B, 0x9F9618C5, 0x272A7FA0,
+        0xBAFD4719, 0x0241207C, 0x10F48F92, 0xA848E8F7, 0x9B14583D, 0x23A83F58,
+        0x311D90B6, 0x89A1F7D3, 0x1476CF6A, 0xACCAA80F, 0xBE7F07E1, 0x06C36084,
+        0x5EA070D2, 0xE61C17B7, 0xF4A9B859, 0x4C15DF3C, 0xD1C2E785, 0x697E80E0,
+        0x7BCB2F0E, 0xC377486B, 0xCB0D0FA2, 0x73B168C7, 0x6104C729, 0xD9B8A04C,
+        0x446F98F5, 0xFCD3FF90, 0xEE66507E, 0x56DA371B, 0x0EB9274D, 0xB6054028,
+        0xA4B0EFC6, 0x1C0C88A3, 0x81DBB01A, 0x3967D77F, 0x2BD27891, 0x936E1FF4,
+        0x3B26F703, 0x839A9066, 0x912F3F88, 0x299358ED, 0xB4446054, 0x0CF80731,
+        0x1E4DA8DF, 0xA6F1CFBA, 0xFE92DFEC, 0x462EB889, 0x549B1767, 0xEC277002,
+        0x71F048BB, 0xC94C2FDE, 0xDBF98030, 0x6345E755, 0x6B3FA09C, 0xD383C7F9,
+        0xC1366817, 0x798A0F72, 0xE45D37CB, 0x5CE150AE, 0x4E54FF40, 0xF6E89825,
+        0xAE8B8873, 0x1637EF16, 0x048240F8, 0xBC3E279D, 0x21E91F24, 0x99557841,
+        0x8BE0D7AF, 0x335CB0CA, 0xED59B63B, 0x55E5D15E, 0x47507EB0, 0xFFEC19D5,
+        0x623B216C, 0xDA874609, 0xC832E9E7, 0x708E8E82, 0x28ED9ED4, 0x9051F9B1,
+        0x82E4565F, 0x3A58313A, 0xA78F0983, 0x1F336EE6, 0x0D86C108, 0xB53AA66D,
+        0xBD40E1A4, 0x05FC86C1, 0x1749292F, 0xAFF54E4A, 0x322276F3, 0x8A9E1196,
+        0x982BBE78, 0x2097D91D, 0x78F4C94B, 0xC048AE2E, 0xD2FD01C0, 0x6A4166A5,
+        0xF7965E1C, 0x4F2A3979, 0x5D9F9697, 0xE523F1F2, 0x4D6B1905, 0xF5D77E60,
+        0xE762D18E, 0x5FDEB6EB, 0xC2098E52, 0x7AB5E937, 0x680046D9, 0xD0BC21BC,
+        0x88DF31EA, 0x3063568F, 0x22D6F961, 0x9A6A9E04, 0x07BDA6BD, 0xBF01C1D8,
+        0xADB46E36, 0x15080953, 0x1D724E9A, 0xA5CE29FF, 0xB77B8611, 0x0FC7E174,
+        0x9210D9CD, 0x2AACBEA8, 0x38191146, 0x80A57623, 0xD8C66675, 0x607A0110,
+        0x72CFAEFE, 0xCA73C99B, 0x57A4F122, 0xEF189647, 0xFDAD39A9, 0x45115ECC,
+        0x764DEE06, 0xCEF18963, 0xDC44268D, 0x64F841E8, 0xF92F7951, 0x41931E34,
+        0x5326B1DA, 0xEB9AD6BF, 0xB3F9C6E9, 0x0B45A18C, 0x19F00E62, 0xA14C6907,
+        0x3C9B51BE, 0x842736DB, 0x96929935, 0x2E2EFE50, 0x2654B999, 0x9EE8DEFC,
+        0x8C5D7112, 0x34E11677, 0xA9362ECE, 0x118A49AB, 0x033FE645, 0xBB838120,
+        0xE3E09176, 0x5B5CF613, 0x49E959FD, 0xF1553E98, 0x6C820621, 0xD43E6144,
+        0xC68BCEAA, 0x7E37A9CF, 0xD67F4138, 0x6EC3265D, 0x7C7689B3, 0xC4CAEED6,
+        0x591DD66F, 0xE1A1B10A, 0xF3141EE4, 0x4BA87981, 0x13CB69D7, 0xAB770EB2,
+        0xB9C2A15C, 0x017EC639, 0x9CA9FE80, 0x241599E5, 0x36A0360B, 0x8E1C516E,
+        0x866616A7, 0x3EDA71C2, 0x2C6FDE2C, 0x94D3B949, 0x090481F0, 0xB1B8E695,
+        0xA30D497B, 0x1BB12E1E, 0x43D23E48, 0xFB6E592D, 0xE9DBF6C3, 0x516791A6,
+        0xCCB0A91F, 0x740CCE7A, 0x66B96194, 0xDE0506F1
+    }
+};
+#endif
+
+//===================================================
+// Method to update a CRC-16/CCITT one bit at a time
+// Reference for crc16(), no table needed
+//===================================================
+unsigned int crc16_bitwise(unsigned int crc, unsigned char *buf, int len)
+{
+    int i;
+
+    while(len-- > 0)
+    {
+        crc ^= *buf++ << 8;
+        for(i = 0; i < 8; i++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc & 0xFFFF;
+}
+
+//===================================================
+// Method to update a CRC-16/CCITT over a buffer
+//===================================================
+unsigned int crc16(unsigned int crc, unsigned char *buf, int len)
+{
+    while(len-- > 0)
+        crc = (crc << 8) ^ crc16_table[((crc >> 8) ^ *buf++) & 0xFF];
+    return crc & 0xFFFF;
+}
+
+//=====================================================================
+// Method to update a CRC-32 one bit at a time
+// Start with crc = 0 and pass the result back in to continue a CRC
+//=====================================================================
+unsigned long crc32_bitwise(unsigned long crc, unsigned char *buf, int len)
+{
+    int i;
+
+    crc = ~crc & 0xFFFFFFFF;
+    while(len-- > 0)
+    {
+        crc ^= *buf++;
+        for(i = 0; i < 8; i++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+    }
+    return ~crc & 0xFFFFFFFF;
+}
+
+//===================================================
+// Method to update a CRC-32 one byte at a time
+//===================================================
+unsigned long crc32_bytewise(unsigned long crc, unsigned char *buf, int len)
+{
+    crc = ~crc & 0xFFFFFFFF;
+    while(len-- > 0)
+        crc = (crc >> 8) ^ crc32_table[(crc ^ *buf++) & 0xFF];
+    return ~crc & 0xFFFFFFFF;
+}
+
+#ifdef CRC_SLICE4
+//=====================================================================
+// Method to update a CRC-32 four bytes at a time
+// The bytes are assembled LSB first so this doesn't depend on the
+// 68K being big endian
+//=====================================================================
+unsigned long crc32_slice4(unsigned long crc, unsigned char *buf, int len)
+{
+    crc = ~crc & 0xFFFFFFFF;
+    while(len >= 4)
+    {
+        crc ^= buf[0] | ((unsigned long)buf[1] << 8) | ((unsigned long)buf[2] << 16) | ((unsigned long)buf[3] << 24);
+        crc = crc32_slice[2][crc & 0xFF] ^ crc32_slice[1][(crc >> 8) & 0xFF] ^
+              crc32_slice[0][(crc >> 16) & 0xFF] ^ crc32_table[(crc >> 24) & 0xFF];
+        buf += 4;
+        len -= 4;
+    }
+    while(len-- > 0)
+        crc = (crc >> 8) ^ crc32_table[(crc ^ *buf++) & 0xFF];
+    return ~crc & 0xFFFFFFFF;
+}
+#endif
+
+//===================================================
+// Method to update a CRC-32 with the variant picked at build time
+//===================================================
+unsigned long crc32(unsigned long crc, unsigned char *buf, int len)
+{
+#ifdef CRC_SLICE4
+    return crc32_slice4(crc, buf, len);
+#else
+    return crc32_bytewise(crc, buf, len);
+#endif
+}
+
+//===================================================
+// Method to add a chunk to a CRC-32, for eeprom_read_stream()
+//===================================================
+void crc32_chunk(int addr, unsigned char *buf, int len, void *arg)
+{
+    *(unsigned long *)arg = crc32(*(unsigned long *)arg, buf, len);
+}
+
+//=====================================================================================
+// Method to write a buffer to the EEPROM and verify it
+// The data is read back through a CRC-32 rather than into a second buffer, so only the
+// CRCs are compared. A buffer that doesn't verify is written again up to VERIFY_RETRIES
+// times. Returns IIC_ERR_CRC if the CRCs still differ.
+//=====================================================================================
+int eeprom_write_verified(int addr, unsigned char *buf, int size)
+{
+    unsigned char chunk[EEPROM_PAGE_SIZE];
+    unsigned long crc, expected = crc32(0, buf, size);
+    int tries, status;
+
+    for(tries = 0; ; tries++)
+    {
+        status = eeprom_write(addr, buf, size);
+        if(status != IIC_OK)
+            return status;
+
+        crc = 0;
+        status = eeprom_read_stream(addr, size, chunk, sizeof(chunk), crc32_chunk, &crc);
+        if(status != IIC_OK)
+            return status;
+        if(crc == expected)
+            return IIC_OK;
+        if(tries >= VERIFY_RETRIES)
+            return IIC_ERR_CRC;
+    }
+}
+
+//=====================================================================
+// Method to get the next chunk of an EEPROM move, see eeprom_move()
+// Chunks never cross a page of the destination, so each is one page
+// write. Going backwards they are taken from the end of the range.
+// Returns the chunk length, its offset in the range is put in *off.
+//=====================================================================
+int move_chunk(int dst, int size, int done, int back, int *off)
+{
+    int n, end;
+
+    if(back)
+    {
+        end = size - done;
+        n = ((dst + end - 1) & (EEPROM_PAGE_SIZE - 1)) + 1;
+        if(n > end)
+            n = end;
+        *off = end - n;
+    }
+    else
+    {
+        n = EEPROM_PAGE_SIZE - ((dst + done) & (EEPROM_PAGE_SIZE - 1));
+        if(n > size - done)
+            n = size - done;
+        *off = done;
+    }
+    return n;
+}
+
+//=====================================================================================
+// Method to move size bytes inside the EEPROM from src to dst, like memmove()
+// When the ranges overlap with dst above src the chunks are moved from the end, so no
+// source byte is overwritten before it has been read. Chunks crossing 0x0FFFF/0x10000
+// are read and written with the block select of each address (see eeprom_address()).
+// Each chunk is read then written, the read of the next one waits for the write cycle
+// by acknowledge polling. Both 64K blocks are one 24LC1025, which NACKs the whole chip
+// during a write cycle, so there is no read to overlap with it.
+// Returns a status code, part of the range may have been moved when it isn't IIC_OK.
+//=====================================================================================
+int eeprom_move(int dst, int src, int size)
+{
+    unsigned char buf[EEPROM_PAGE_SIZE];
+    int done, off, n, status = IIC_OK;
+
+    if(dst < 0 || src < 0 || size < 0 || dst + size > EEPROM_SIZE || src + size > EEPROM_SIZE)
+        return IIC_ERR_RANGE;
+
+    for(done = 0; done < size && dst != src && status == IIC_OK; done += n)
+    {
+        n = move_chunk(dst, size, done, dst > src, &off);
+        status = eeprom_read(src + off, buf, n);
+        if(status == IIC_OK)
+            status = eeprom_write(dst + off, buf, n);   // Returns with the write cycle started
+    }
+    return status;
+}
+
+//=====================================================================
+// Method to write a CRC protected page
+// CRC_PAGE_DATA bytes of data followed by their CRC-32, MSB first
+//=====================================================================
+int page_write_crc(int page, unsigned char *data)
+{
+    unsigned char buf[EEPROM_PAGE_SIZE];
+    unsigned long crc;
+
+    memcpy(buf, data, CRC_PAGE_DATA);
+    crc = crc32(0, data, CRC_PAGE_DATA);
+    buf[CRC_PAGE_DATA] = (crc >> 24) & 0xFF;
+    buf[CRC_PAGE_DATA + 1] = (crc >> 16) & 0xFF;
+    buf[CRC_PAGE_DATA + 2] = (crc >> 8) & 0xFF;
+    buf[CRC_PAGE_DATA + 3] = crc & 0xFF;
+    return eeprom_write(page & ~(EEPROM_PAGE_SIZE - 1), buf, EEPROM_PAGE_SIZE);
+}
+
+//=====================================================================
+// Method to read a CRC protected page
+// Returns IIC_ERR_CRC if the data doesn't match the stored CRC
+//=====================================================================
+int page_read_crc(int page, unsigned char *data)
+{
+    unsigned char buf[EEPROM_PAGE_SIZE];
+    unsigned long crc;
+    int status;
+
+    status = eeprom_read(page & ~(EEPROM_PAGE_SIZE - 1), buf, EEPROM_PAGE_SIZE);
+    if(status != IIC_OK)
+        return status;
+
+    crc = ((unsigned long)buf[CRC_PAGE_DATA] << 24) | ((unsigned long)buf[CRC_PAGE_DATA + 1] << 16) |
+          ((unsigned long)buf[CRC_PAGE_DATA + 2] << 8) | buf[CRC_PAGE_DATA + 3];
+    memcpy(data, buf, CRC_PAGE_DATA);
+    return crc == crc32(0, buf, CRC_PAGE_DATA) ? IIC_OK : IIC_ERR_CRC;
+}
+
+//===================================================
+// Method to empty the EEPROM cache without writing it back
+//===================================================
+void cache_init(void)
+{
+    int i;
+
+    for(i = 0; i < CACHE_LINES; i++)
+    {
+        cache[i].page = -1;
+        cache[i].dirty = 0;
+        cache[i].used = 0;
+    }
+    cache_clock = cache_hits = cache_misses = cache_flushes = 0;
+}
+
+//===================================================
+// Method to write a dirty cache line back as one full page write
+//===================================================
+int cache_writeback(struct cache_line *line)
+{
+    int status;
+
+    if(line->page < 0 || !line->dirty)
+        return IIC_OK;
+
+    status = eeprom_write(line->page, line->data, EEPROM_PAGE_SIZE);
+    if(status == IIC_OK)
+    {
+        line->dirty = 0;
+        cache_flushes++;
+    }
+    return status;
+}
+
+//=====================================================================================
+// Method to find the cache line holding an EEPROM page
+// On a miss the least recently used line is written back if dirty and reused. The page
+// is read in unless fill is 0, which is used when the whole page will be overwritten.
+//=====================================================================================
+int cache_get(int page, int fill, struct cache_line **out)
+{
+    struct cache_line *line = &cache[0];
+    int i, status;
+
+    for(i = 0; i < CACHE_LINES; i++)
+    {
+        if(cache[i].page == page)
+        {
+            cache_hits++;
+            cache[i].used = ++cache_clock;
+            *out = &cache[i];
+            return IIC_OK;
+        }
+        if(cache[i].used < line->used)
+            line = &cache[i];
+    }
+
+    cache_misses++;
+    status = cache_writeback(line);
+    if(status != IIC_OK)
+        return status;
+
+    line->page = -1;
+    if(fill)
+    {
+        status = eeprom_read(page, line->data, EEPROM_PAGE_SIZE);
+        if(status != IIC_OK)
+            return status;
+    }
+    line->page = page;
+    line->used = ++cache_clock;
+    *out = line;
+    return IIC_OK;
+}
+
+//===================================================
+// Method to read from the EEPROM through the cache
+//===================================================
+int cache_read(int addr, unsigned char *buf, int size)
+{
+    struct cache_line *line;
+    int offset, chunk, status;
+
+    if(addr < 0 || addr > 0x1FFFF || size < 0 || size > EEPROM_SIZE)
+        return IIC_ERR_RANGE;
+
+    while(size > 0)
+    {
+        offset = addr & (EEPROM_PAGE_SIZE - 1);
+        chunk = EEPROM_PAGE_SIZE - offset;
+        if(chunk > size)
+            chunk = size;
+
+        status = cache_get(addr - offset, 1, &line);
+        if(status != IIC_OK)
+            return status;
+        memcpy(buf, line->data + offset, chunk);
+
+        buf += chunk;
+        size -= chunk;
+        addr = (addr + chunk) & 0x1FFFF;
+    }
+    return IIC_OK;
+}
+
+//=====================================================================================
+// Method to write to the EEPROM through the cache
+// Only the cache is updated, the pages are written back when evicted or by cache_flush()
+//=====================================================================================
+int cache_write(int addr, unsigned char *buf, int size)
+{
+    struct cache_line *line;
+    int offset, chunk, status;
+
+    if(addr < 0 || addr > 0x1FFFF || size < 0 || size > EEPROM_SIZE)
+        return IIC_ERR_RANGE;
+
+    while(size > 0)
+    {
+        offset = addr & (EEPROM_PAGE_SIZE - 1);
+        chunk = EEPROM_PAGE_SIZE - offset;
+        if(chunk > size)
+            chunk = size;
+
+        status = cache_get(addr - offset, chunk != EEPROM_PAGE_SIZE, &line);
+        if(status != IIC_OK)
+            return status;
+        memcpy(line->data + offset, buf, chunk);
+        line->dirty = 1;
+
+        buf += chunk;
+        size -= chunk;
+        addr = (addr + chunk) & 0x1FFFF;
+    }
+    return IIC_OK;
+}
+
+//===================================================
+// Method to write all dirty cache lines back to the EEPROM
+//===================================================
+int cache_flush(void)
+{
+    int i, status;
+
+    for(i = 0; i < CACHE_LINES; i++)
+    {
+        status = cache_writeback(&cache[i]);
+        if(status != IIC_OK)
+            return status;
+    }
+    return IIC_OK;
+}
+
+//===================================================
+// Method to print the cache counters
+//===================================================
+void cache_stats(void)
+{
+    printf("stats=cache hits=%lu misses=%lu page_flushes=%lu\n", cache_hits, cache_misses, cache_flushes);
+}
+
+//===================================================
+// Method to drop all pending EEPROM updates
+//===================================================
+void update_init(void)
+{
+    int i;
+
+    for(i = 0; i < UPDATE_PAGES; i++)
+        updates[i].page = -1;
+}
+
+//=====================================================================================
+// Method to write the pending updates of one page with a single page write
+// Only the bytes between the first and last pending byte are written. Bytes in that
+// range with no pending data are the only ones read back from the EEPROM first.
+//=====================================================================================
+int update_commit_page(struct update_page *u)
+{
+    int i, first = -1, last = -1, gap = -1, status;
+
+    for(i = 0; i <= EEPROM_PAGE_SIZE; i++)
+    {
+        if(i < EEPROM_PAGE_SIZE && (u->mask[i >> 3] & (1 << (i & 7))))
+        {
+            if(first < 0)
+                first = i;
+            last = i;
+            if(gap >= 0)
+            {
+                // Preserve the unchanged bytes between two pending runs
+                status = eeprom_read(u->page + gap, u->data + gap, i - gap);
+                if(status != IIC_OK)
+                    return status;
+                gap = -1;
+            }
+        }
+        else if(first >= 0 && gap < 0)
+            gap = i;
+    }
+
+    if(first >= 0)
+    {
+        status = eeprom_write(u->page + first, u->data + first, last - first + 1);
+        if(status != IIC_OK)
+            return status;
+    }
+    u->page = -1;
+    return IIC_OK;
+}
+
+//===================================================
+// Method to write all pending EEPROM updates
+//===================================================
+int eeprom_commit(void)
+{
+    int i, status;
+
+    for(i = 0; i < UPDATE_PAGES; i++)
+    {
+        if(updates[i].page < 0)
+            continue;
+        status = update_commit_page(&updates[i]);
+        if(status != IIC_OK)
+            return status;
+    }
+    return IIC_OK;
+}
+
+//=====================================================================
+// Method to write the pending updates that cover a whole page
+// Lets a stream of records go out a page at a time as each fills,
+// rather than in bursts when every slot is taken
+//=====================================================================
+int update_commit_full(void)
+{
+    int i, j, status;
+
+    for(i = 0; i < UPDATE_PAGES; i++)
+    {
+        if(updates[i].page < 0)
+            continue;
+        for(j = 0; j < EEPROM_PAGE_SIZE / 8 && updates[i].mask[j] == 0xFF; j++)
+            ;
+        if(j < EEPROM_PAGE_SIZE / 8)
+            continue;
+        status = update_commit_page(&updates[i]);
+        if(status != IIC_OK)
+            return status;
+    }
+    return IIC_OK;
+}
+
+//=====================================================================================
+// Method to queue an update of size bytes at an arbitrary address
+// Updates are held per page and merged with earlier pending updates (newer data wins),
+// so any number of overlapping or scattered updates to a page cost one page write when
+// eeprom_commit() runs. If every pending slot is in use they are committed first.
+//=====================================================================================
+int eeprom_update(int addr, unsigned char *buf, int size)
+{
+    struct update_page *u;
+    int i, page, offset, chunk, status;
+
+    if(addr < 0 || addr > 0x1FFFF || size < 0 || size > EEPROM_SIZE)
+        return IIC_ERR_RANGE;
+
+    while(size > 0)
+    {
+        offset = addr & (EEPROM_PAGE_SIZE - 1);
+        page = addr - offset;
+        chunk = EEPROM_PAGE_SIZE - offset;
+        if(chunk > size)
+            chunk = size;
+
+        u = 0;
+        for(i = 0; i < UPDATE_PAGES && !u; i++)
+            if(updates[i].page == page)
+                u = &updates[i];
+        for(i = 0; i < UPDATE_PAGES && !u; i++)
+            if(updates[i].page < 0)
+                u = &updates[i];
+        if(!u)
+        {
+            status = eeprom_commit();
+            if(status != IIC_OK)
+                return status;
+            u = &updates[0];
+        }
+        if(u->page != page)
+        {
+            u->page = page;
+            memset(u->mask, 0, sizeof(u->mask));
+        }
+
+        memcpy(u->data + offset, buf, chunk);
+        for(i = offset; i < offset + chunk; i++)
+            u->mask[i >> 3] |= 1 << (i & 7);
+
+        buf += chunk;
+        size -= chunk;
+        addr = (addr + chunk) & 0x1FFFF;
+    }
+    return IIC_OK;
+}
+
+//===================================================
+// Method to get the EEPROM address of a log page
+//===================================================
+int log_addr(int page)
+{
+    return LOG_START + page * EEPROM_PAGE_SIZE;
+}
+
+//===================================================
+// Method to start an empty page at log_head
+//===================================================
+void log_reset_page(void)
+{
+    log_count = 0;
+    log_fill = 0;
+}
+
+//===================================================
+// Method to add a record to the page being built
+// Returns 0 if it doesn't fit
+//===================================================
+int log_add(int key, unsigned char *data, int len)
+{
+    if(LOG_HDR + 2 * (log_count + 1) + log_fill + len > EEPROM_PAGE_SIZE)
+        return 0;
+
+    log_dir[2 * log_count] = key;
+    log_dir[2 * log_count + 1] = len;
+    memcpy(log_data + log_fill, data, len);
+
+    log_index[key].page = LOG_PENDING;
+    log_index[key].offset = log_fill;
+    log_index[key].len = len;
+    log_index[key].seq = ((unsigned long)log_seq << 6) + log_count;
+
+    log_count++;
+    log_fill += len;
+    return 1;
+}
+
+//=====================================================================================
+// Method to reclaim the page at log_tail
+// Records in it that are still the newest for their key are moved into the page being
+// built. Called with that page empty, and a page's records always fit in one page.
+//=====================================================================================
+int log_gc(void)
+{
+    unsigned char data[EEPROM_PAGE_SIZE];
+    int key, status;
+
+    for(key = 0; key < LOG_KEYS; key++)
+    {
+        if(log_index[key].page != log_tail)
+            continue;
+        status = eeprom_read(log_addr(log_tail) + log_index[key].offset, data, log_index[key].len);
+        if(status != IIC_OK)
+            return status;
+        log_add(key, data, log_index[key].len);
+    }
+    log_tail = (log_tail + 1) % LOG_PAGES;
+    log_used--;
+    return IIC_OK;
+}
+
+//=====================================================================================
+// Method to write a checkpoint of the log state and RAM index
+// Checkpoints alternate between the two pages at LOG_CHECKPOINT so a torn write leaves
+// the previous one intact. Layout:
+//   [LOG_CP_MAGIC][cp seq (2)][log_seq (2)][log_head (2)][log_tail (2)][log_used (2)]
+//   then per key [page (10 bits) / record number (6 bits)][offset][len], page 0x3FF if none
+//   and a CRC-16 of the first 126 bytes in the last two bytes
+// Must only be called with no records pending, log_sync() does it every LOG_CP_INTERVAL pages.
+//=====================================================================================
+int log_checkpoint(void)
+{
+    unsigned char cp[EEPROM_PAGE_SIZE];
+    unsigned int crc, v;
+    int key, status;
+
+    memset(cp, 0xFF, sizeof(cp));
+    log_cp_seq = (log_cp_seq + 1) & 0xFFFF;
+    cp[0] = LOG_CP_MAGIC;
+    cp[1] = log_cp_seq >> 8;    cp[2] = log_cp_seq & 0xFF;
+    cp[3] = log_seq >> 8;       cp[4] = log_seq & 0xFF;
+    cp[5] = log_head >> 8;      cp[6] = log_head & 0xFF;
+    cp[7] = log_tail >> 8;      cp[8] = log_tail & 0xFF;
+    cp[9] = log_used >> 8;      cp[10] = log_used & 0xFF;
+
+    for(key = 0; key < LOG_KEYS; key++)
+    {
+        if(log_index[key].page < 0)
+            continue;
+        v = (log_index[key].page << 6) | (log_index[key].seq & 0x3F);
+        cp[11 + 4 * key] = v >> 8;
+        cp[12 + 4 * key] = v & 0xFF;
+        cp[13 + 4 * key] = log_index[key].offset;
+        cp[14 + 4 * key] = log_index[key].len;
+    }
+
+    crc = crc16(0xFFFF, cp, EEPROM_PAGE_SIZE - 2);
+    cp[EEPROM_PAGE_SIZE - 2] = crc >> 8;
+    cp[EEPROM_PAGE_SIZE - 1] = crc & 0xFF;
+
+    status = eeprom_write(LOG_CHECKPOINT + (log_cp_seq & 1) * EEPROM_PAGE_SIZE, cp, EEPROM_PAGE_SIZE);
+    if(status == IIC_OK)
+        log_cp_due = 0;
+    return status;
+}
+
+//=====================================================================
+// Method to load the newest valid checkpoint into the log state
+// Returns 1 if one was loaded, 0 if neither page holds a valid checkpoint
+//=====================================================================
+int log_load_checkpoint(void)
+{
+    unsigned char cp[2][EEPROM_PAGE_SIZE];
+    unsigned int seq[2], v;
+    int i, best = -1, key;
+
+    for(i = 0; i < 2; i++)
+    {
+        if(eeprom_read(LOG_CHECKPOINT + i * EEPROM_PAGE_SIZE, cp[i], EEPROM_PAGE_SIZE) != IIC_OK ||
+           cp[i][0] != LOG_CP_MAGIC ||
+           crc16(0xFFFF, cp[i], EEPROM_PAGE_SIZE - 2) != ((cp[i][EEPROM_PAGE_SIZE - 2] << 8) | cp[i][EEPROM_PAGE_SIZE - 1]))
+            continue;
+        seq[i] = (cp[i][1] << 8) | cp[i][2];
+        if(best < 0 || ((seq[i] - seq[best]) & 0x8000) == 0)
+            best = i;
+    }
+    if(best < 0)
+        return 0;
+
+    log_cp_seq = seq[best];
+    log_seq = (cp[best][3] << 8) | cp[best][4];
+    log_head = (cp[best][5] << 8) | cp[best][6];
+    log_tail = (cp[best][7] << 8) | cp[best][8];
+    log_used = (cp[best][9] << 8) | cp[best][10];
+
+    for(key = 0; key < LOG_KEYS; key++)
+    {
+        v = (cp[best][11 + 4 * key] << 8) | cp[best][12 + 4 * key];
+        if((v >> 6) >= LOG_PAGES)
+        {
+            log_index[key].page = LOG_NONE;
+            continue;
+        }
+        log_index[key].page = v >> 6;
+        log_index[key].offset = cp[best][13 + 4 * key];
+        log_index[key].len = cp[best][14 + 4 * key];
+        // Page sequence numbers count up to log_seq at log_head
+        log_index[key].seq = ((unsigned long)((log_seq - (log_head - (int)(v >> 6) + LOG_PAGES) % LOG_PAGES) & 0xFFFF) << 6) | (v & 0x3F);
+    }
+    return 1;
+}
+
+//=====================================================================================
+// Method to write the page being built to the EEPROM as one page write
+// Appends are batched in RAM until a page is full, call this to force them out.
+//=====================================================================================
+int log_sync(void)
+{
+    unsigned char page[EEPROM_PAGE_SIZE];
+    int key, base, status;
+
+    if(log_count == 0)
+        return IIC_OK;
+
+    base = LOG_HDR + 2 * log_count;
+    memset(page, 0xFF, sizeof(page));
+    page[0] = LOG_MAGIC;
+    page[1] = (log_seq >> 8) & 0xFF;
+    page[2] = log_seq & 0xFF;
+    page[3] = log_count;
+    memcpy(page + LOG_HDR, log_dir, 2 * log_count);
+    memcpy(page + base, log_data, log_fill);
+
+    status = eeprom_write(log_addr(log_head), page, EEPROM_PAGE_SIZE);
+    if(status != IIC_OK)
+        return status;
+
+    for(key = 0; key < LOG_KEYS; key++)
+    {
+        if(log_index[key].page == LOG_PENDING)
+        {
+            log_index[key].page = log_head;
+            log_index[key].offset += base;
+        }
+    }
+    log_head = (log_head + 1) % LOG_PAGES;
+    log_seq = (log_seq + 1) & 0xFFFF;
+    log_used++;
+    log_reset_page();
+
+    // Nothing is pending here, so the index matches what is on the EEPROM
+    if(++log_cp_due >= LOG_CP_INTERVAL)
+    {
+        status = log_checkpoint();
+        if(status != IIC_OK)
+            return status;
+    }
+
+    // Keep the page at log_head free for the next write
+    if(log_used >= LOG_PAGES - 1)
+        return log_gc();
+    return IIC_OK;
+}
+
+//===================================================
+// Method to append a record to the log
+//===================================================
+int log_append(int key, unsigned char *data, int len)
+{
+    int status;
+
+    if(key < 0 || key >= LOG_KEYS || len < 0 || LOG_HDR + 2 + len > EEPROM_PAGE_SIZE)
+        return IIC_ERR_RANGE;
+
+    // The new page may already hold records moved by log_gc()
+    while(!log_add(key, data, len))
+    {
+        status = log_sync();
+        if(status != IIC_OK)
+            return status;
+    }
+    return IIC_OK;
+}
+
+//=====================================================================
+// Method to read the newest record with a key
+// Returns the record length, or IIC_ERR_RANGE if there is no record
+//=====================================================================
+int log_find(int key, unsigned char *buf, int size, unsigned long *seq)
+{
+    struct log_entry *e;
+    int len, status;
+
+    if(key < 0 || key >= LOG_KEYS || log_index[key].page == LOG_NONE)
+        return IIC_ERR_RANGE;
+
+    e = &log_index[key];
+    len = e->len < size ? e->len : size;
+    if(e->page == LOG_PENDING)
+        memcpy(buf, log_data + e->offset, len);
+    else
+    {
+        status = eeprom_read(log_addr(e->page) + e->offset, buf, len);
+        if(status != IIC_OK)
+            return status;
+    }
+    if(seq)
+        *seq = e->seq;
+    return e->len;
+}
+
+//=====================================================================
+// Method to read the record with a sequence number, if it is still in the log
+// Returns the record length and its key, or IIC_ERR_RANGE
+//=====================================================================
+int log_find_seq(unsigned long seq, int *key, unsigned char *buf, int size)
+{
+    unsigned char hdr[LOG_HDR], dir[EEPROM_PAGE_SIZE];
+    int i, page, age, offset, status;
+
+    // Pages are written with consecutive sequence numbers ending before log_head
+    age = (log_seq - (seq >> 6)) & 0xFFFF;
+    if(age == 0)
+    {
+        if((seq & 0x3F) >= log_count)
+            return IIC_ERR_RANGE;
+        for(i = 0, offset = 0; i < (seq & 0x3F); i++)
+            offset += log_dir[2 * i + 1];
+        *key = log_dir[2 * i];
+        size = log_dir[2 * i + 1] < size ? log_dir[2 * i + 1] : size;
+        memcpy(buf, log_data + offset, size);
+        return log_dir[2 * i + 1];
+    }
+    if(age > log_used)
+        return IIC_ERR_RANGE;
+
+    page = (log_head - age + LOG_PAGES) % LOG_PAGES;
+    status = eeprom_read(log_addr(page), hdr, LOG_HDR);
+    if(status != IIC_OK)
+        return status;
+    if(hdr[0] != LOG_MAGIC || (seq & 0x3F) >= hdr[3])
+        return IIC_ERR_RANGE;
+    status = eeprom_read(log_addr(page) + LOG_HDR, dir, 2 * hdr[3]);
+    if(status != IIC_OK)
+        return status;
+
+    offset = LOG_HDR + 2 * hdr[3];
+    for(i = 0; i < (seq & 0x3F); i++)
+        offset += dir[2 * i + 1];
+    *key = dir[2 * i];
+    status = eeprom_read(log_addr(page) + offset, buf, dir[2 * i + 1] < size ? dir[2 * i + 1] : size);
+    if(status != IIC_OK)
+        return status;
+    return dir[2 * i + 1];
+}
+
+//===================================================
+// Method to read the header of a log page
+// Returns its sequence number, or -1 if it isn't a log page
+//===================================================
+int log_page_seq(int page, unsigned char *hdr)
+{
+    if(eeprom_read(log_addr(page), hdr, LOG_HDR) != IIC_OK || hdr[0] != LOG_MAGIC)
+        return -1;
+    return (hdr[1] << 8) | hdr[2];
+}
+
+//=====================================================================================
+// Method to replay the record directory of a log page into the RAM index
+// Newer records replace older ones, so pages must be replayed oldest first
+//=====================================================================================
+int log_replay(int page, int seq, int count)
+{
+    unsigned char dir[EEPROM_PAGE_SIZE];
+    int i, offset, status;
+
+    if(count == 0)
+        return IIC_OK;
+    status = eeprom_read(log_addr(page) + LOG_HDR, dir, 2 * count);
+    if(status != IIC_OK)
+        return status;
+
+    offset = LOG_HDR + 2 * count;
+    for(i = 0; i < count; i++)
+    {
+        if(dir[2 * i] < LOG_KEYS)
+        {
+            log_index[dir[2 * i]].page = page;
+            log_index[dir[2 * i]].offset = offset;
+            log_index[dir[2 * i]].len = dir[2 * i + 1];
+            log_index[dir[2 * i]].seq = ((unsigned long)seq << 6) + i;
+        }
+        offset += dir[2 * i + 1];
+    }
+    return IIC_OK;
+}
+
+//=====================================================================================
+// Method to free the page at log_head after a restart
+// Reclaimed pages keep a valid header, so after a restart the ring can look full.
+// Reclaim from log_tail the same way log_sync() does until log_head is free again.
+//=====================================================================================
+int log_make_room(void)
+{
+    int status;
+
+    while(log_used >= LOG_PAGES - 1)
+    {
+        status = log_count ? log_sync() : log_gc();
+        if(status != IIC_OK)
+            return status;
+    }
+    return IIC_OK;
+}
+
+//=====================================================================================
+// Method to rebuild the RAM index of the log without a checkpoint
+// Only the 4 byte page headers are read to find the newest page and the run of pages
+// with consecutive sequence numbers before it. The record directories of those pages
+// are then replayed oldest first, so the record data itself is never read.
+//=====================================================================================
+int log_scan(void)
+{
+    unsigned char hdr[LOG_HDR];
+    static int seqs[LOG_PAGES];
+    static unsigned char counts[LOG_PAGES];
+    int i, page, newest = -1, status;
+
+    for(i = 0; i < LOG_KEYS; i++)
+        log_index[i].page = LOG_NONE;
+
+    for(page = 0; page < LOG_PAGES; page++)
+    {
+        seqs[page] = log_page_seq(page, hdr);
+        counts[page] = hdr[3];
+    }
+
+    // The newest page is one whose successor doesn't carry on its sequence
+    for(page = 0; page < LOG_PAGES && newest < 0; page++)
+    {
+        i = seqs[(page + 1) % LOG_PAGES];
+        if(seqs[page] >= 0 && (i < 0 || ((i - seqs[page]) & 0xFFFF) != 1))
+            newest = page;
+    }
+
+    if(newest < 0)
+    {
+        // Empty log
+        log_head = log_tail = log_used = 0;
+        log_seq = 0;
+        return IIC_OK;
+    }
+
+    // Walk back to the oldest page of the run
+    log_tail = newest;
+    log_used = 1;
+    while(log_used < LOG_PAGES)
+    {
+        page = (log_tail - 1 + LOG_PAGES) % LOG_PAGES;
+        if(seqs[page] < 0 || ((seqs[newest] - seqs[page]) & 0xFFFF) != log_used)
+            break;
+        log_tail = page;
+        log_used++;
+    }
+    log_head = (newest + 1) % LOG_PAGES;
+    log_seq = (seqs[newest] + 1) & 0xFFFF;
+
+    for(i = 0, page = log_tail; i < log_used; i++, page = (page + 1) % LOG_PAGES)
+    {
+        status = log_replay(page, seqs[page], counts[page]);
+        if(status != IIC_OK)
+            return status;
+    }
+    return log_make_room();
+}
+
+//=====================================================================================
+// Method to rebuild the RAM index of the log at startup
+// With a valid checkpoint only the two checkpoint pages and the pages written after
+// it are read. Without one the whole ring of page headers is scanned by log_scan().
+//=====================================================================================
+int log_mount(void)
+{
+    unsigned char hdr[LOG_HDR], data[EEPROM_PAGE_SIZE];
+    int i, key, status;
+
+    log_reset_page();
+    log_cp_due = 0;
+    if(!log_load_checkpoint())
+    {
+        log_cp_seq = 0;
+        return log_scan();
+    }
+
+    // Replay the pages written since the checkpoint, they carry on its sequence
+    for(i = 0; i < LOG_PAGES && log_page_seq(log_head, hdr) == log_seq; i++)
+    {
+        status = log_replay(log_head, log_seq, hdr[3]);
+        if(status != IIC_OK)
+            return status;
+        log_head = (log_head + 1) % LOG_PAGES;
+        log_seq = (log_seq + 1) & 0xFFFF;
+        log_cp_due++;
+
+        // log_sync() reclaimed the tail page here, its records were moved into later pages
+        if(++log_used >= LOG_PAGES - 1)
+        {
+            log_tail = (log_tail + 1) % LOG_PAGES;
+            log_used--;
+        }
+    }
+
+    // Records moved by the last reclaim may not have been written, move them again
+    for(key = 0; key < LOG_KEYS; key++)
+    {
+        if(log_index[key].page < 0 || (log_index[key].page - log_tail + LOG_PAGES) % LOG_PAGES < log_used)
+            continue;
+        status = eeprom_read(log_addr(log_index[key].page) + log_index[key].offset, data, log_index[key].len);
+        if(status == IIC_OK)
+            status = log_append(key, data, log_index[key].len);
+        if(status != IIC_OK)
+            return status;
+    }
+    return log_make_room();
+}
+
+//=====================================================================
+// Method to erase the log by clearing the magic byte of every page
+//=====================================================================
+int log_format(void)
+{
+    unsigned char zero = 0;
+    int page, status;
+
+    for(page = 0; page < LOG_PAGES + 2; page++)     // Log pages and both checkpoints
+    {
+        status = eeprom_write(log_addr(page), &zero, 1);
+        if(status != IIC_OK)
+            return status;
+    }
+    return log_mount();
+}
+
+//===================================================
+// Method to get the bits needed for a zigzag coded value
+//===================================================
+int slog_width(int z)
+{
+    int w = 0;
+
+    while(z)
+    {
+        w++;
+        z >>= 1;
+    }
+    return w;
+}
+
+//===================================================
+// Method to zigzag code a difference, -1 -> 1, 1 -> 2, -2 -> 3 ...
+//===================================================
+int slog_zigzag(int d)
+{
+    return d >= 0 ? d << 1 : ((-d) << 1) - 1;
+}
+
+//=====================================================================
+// Method to read the header of a block
+// Returns the length of the block or 0 if it isn't a block of session
+// (any session if session is -1)
+//=====================================================================
+int slog_header(struct slog *s, int session)
+{
+    int i, bits = 0;
+
+    if(s->io(s->start + s->block * EEPROM_PAGE_SIZE, s->page, SLOG_HDR) != IIC_OK || s->page[0] != SLOG_MAGIC)
+        return 0;
+    if(session >= 0 && s->page[1] != session)
+        return 0;
+
+    s->frames = s->page[2];
+    s->width[0] = s->page[6] & 0x0F;
+    s->width[1] = s->page[6] >> 4;
+    s->width[2] = s->page[7] & 0x0F;
+    for(i = 0; i < SLOG_CHANNELS; i++)
+        bits += s->width[i];
+    bits *= s->frames - 1;
+    return s->frames > 0 && bits <= SLOG_BITS ? SLOG_HDR + (bits + 7) / 8 : 0;
+}
+
+//=====================================================================
+// Method to start a new log of pages blocks at start
+// The session is one more than the log found there, so none of the
+// old blocks are read back as part of the new log.
+//=====================================================================
+void slog_create(struct slog *s, int start, int pages, int (*read)(int, unsigned char *, int),
+                 int (*write)(int, unsigned char *, int))
+{
+    s->start = start;
+    s->pages = pages;
+    s->block = 0;
+    s->io = read;
+    s->session = slog_header(s, -1) ? (s->page[1] + 1) & 0xFF : 0;
+    s->io = write;
+    s->frames = 0;
+    s->bytes = 0;
+}
+
+//=====================================================================
+// Method to write the frames held as one block
+//=====================================================================
+int slog_flush(struct slog *s)
+{
+    unsigned char *p = s->page + SLOG_HDR;
+    unsigned int acc = 0, crc;
+    int i, c, n = 0, len, status;
+
+    if(s->frames == 0)
+        return IIC_OK;
+    if(s->block >= s->pages)
+        return IIC_ERR_RANGE;
+
+    s->page[0] = SLOG_MAGIC;
+    s->page[1] = s->session;
+    s->page[2] = s->frames;
+    for(c = 0; c < SLOG_CHANNELS; c++)
+        s->page[3 + c] = s->data[0][c];
+    s->page[6] = s->width[0] | (s->width[1] << 4);
+    s->page[7] = s->width[2];
+
+    // Pack the differences LSB first, n bits are waiting in acc
+    for(i = 1; i < s->frames; i++)
+        for(c = 0; c < SLOG_CHANNELS; c++)
+        {
+            acc |= slog_zigzag(s->data[i][c] - s->data[i - 1][c]) << n;
+            n += s->width[c];
+            while(n >= 8)
+            {
+                *p++ = acc & 0xFF;
+                acc >>= 8;
+                n -= 8;
+            }
+        }
+    if(n > 0)
+        *p++ = acc & 0xFF;
+
+    len = p - s->page;
+    crc = crc16(0xFFFF, s->page, 8);
+    crc = crc16(crc, s->page + SLOG_HDR, len - SLOG_HDR);
+    s->page[8] = crc >> 8;
+    s->page[9] = crc & 0xFF;
+
+    status = s->io(s->start + s->block * EEPROM_PAGE_SIZE, s->page, len);
+    if(status != IIC_OK)
+        return status;
+    s->bytes += len;
+    s->block++;
+    s->frames = 0;
+    return IIC_OK;
+}
+
+//=====================================================================================
+// Method to add a frame of SLOG_CHANNELS samples to the log
+// Frames are held until the next one would make the block overflow a page, then the
+// block is written. Returns IIC_ERR_RANGE once the log is full.
+//=====================================================================================
+int slog_add(struct slog *s, unsigned char *frame)
+{
+    int c, w[SLOG_CHANNELS], bits = 0, status;
+
+    if(s->frames > 0)
+    {
+        for(c = 0; c < SLOG_CHANNELS; c++)
+        {
+            w[c] = slog_width(slog_zigzag(frame[c] - s->data[s->frames - 1][c]));
+            if(w[c] < s->width[c])
+                w[c] = s->width[c];
+            bits += w[c];
+        }
+        if(s->frames == SLOG_MAX_FRAMES || (long)bits * s->frames > SLOG_BITS)
+        {
+            status = slog_flush(s);
+            if(status != IIC_OK)
+                return status;
+        }
+    }
+
+    if(s->frames == 0)
+    {
+        if(s->block >= s->pages)
+            return IIC_ERR_RANGE;
+        for(c = 0; c < SLOG_CHANNELS; c++)
+            s->width[c] = 0;
+    }
+    else
+        for(c = 0; c < SLOG_CHANNELS; c++)
+            s->width[c] = w[c];
+
+    for(c = 0; c < SLOG_CHANNELS; c++)
+        s->data[s->frames][c] = frame[c];
+    s->frames++;
+    return IIC_OK;
+}
+
+//===================================================
+// Method to start reading the log at start
+//===================================================
+void slog_open(struct slog *s, int start, int pages, int (*read)(int, unsigned char *, int))
+{
+    s->start = start;
+    s->pages = pages;
+    s->block = 0;
+    s->io = read;
+    s->session = slog_header(s, -1) ? s->page[1] : -1;
+    s->frames = 0;
+    s->pos = 0;
+    s->bytes = 0;
+}
+
+//=====================================================================================
+// Method to read the next frame from the log
+// Streams a block at a time, so only one page is held. Returns 1 with the frame, 0 at
+// the end of the log or IIC_ERR_CRC if a block is damaged.
+//=====================================================================================
+int slog_next(struct slog *s, unsigned char *frame)
+{
+    unsigned int crc;
+    int c, len, z, d;
+
+    if(s->pos == s->frames)
+    {
+        // Load the next block
+        if(s->session < 0 || s->block >= s->pages || !(len = slog_header(s, s->session)))
+            return 0;
+        if(s->io(s->start + s->block * EEPROM_PAGE_SIZE + SLOG_HDR, s->page + SLOG_HDR, len - SLOG_HDR) != IIC_OK)
+            return IIC_ERR_CRC;
+        crc = crc16(0xFFFF, s->page, 8);
+        crc = crc16(crc, s->page + SLOG_HDR, len - SLOG_HDR);
+        if(crc != ((s->page[8] << 8) | s->page[9]))
+            return IIC_ERR_CRC;
+
+        s->bytes += len;
+        s->block++;
+        s->pos = 1;
+        s->next = SLOG_HDR;
+        s->acc = 0;
+        s->nbits = 0;
+        for(c = 0; c < SLOG_CHANNELS; c++)
+            frame[c] = s->prev[c] = s->page[3 + c];
+        return 1;
+    }
+
+    for(c = 0; c < SLOG_CHANNELS; c++)
+    {
+        while(s->nbits < s->width[c])
+        {
+            s->acc |= s->page[s->next++] << s->nbits;
+            s->nbits += 8;
+        }
+        z = s->acc & ((1 << s->width[c]) - 1);
+        s->acc >>= s->width[c];
+        s->nbits -= s->width[c];
+        d = (z & 1) ? -((z + 1) >> 1) : z >> 1;
+        frame[c] = s->prev[c] = s->prev[c] + d;
+    }
+    s->pos++;
+    return 1;
+}
+
+//===================================================
+// Methods to use slog_ram in place of the EEPROM
+//===================================================
+int slog_ram_write(int addr, unsigned char *buf, int size)
+{
+    if(addr < 0 || addr + size > sizeof(slog_ram))
+        return IIC_ERR_RANGE;
+    memcpy(slog_ram + addr, buf, size);
+    return IIC_OK;
+}
+
+int slog_ram_read(int addr, unsigned char *buf, int size)
+{
+    if(addr < 0 || addr + size > sizeof(slog_ram))
+        return IIC_ERR_RANGE;
+    memcpy(buf, slog_ram + addr, size);
+    return IIC_OK;
+}
+
+//=====================================================================================
+// Host link, see proto.h for the frame format
+//=====================================================================================
+struct proto_rx proto_in;
+unsigned char proto_out[PROTO_MAX_FRAME];
+
+//===================================================
+// Method to send a frame to the host
+//===================================================
+void proto_send(int cmd, int seq, unsigned char *payload, int len)
+{
+    int i, n = proto_frame(proto_out, cmd, seq, payload, len);
+
+    for(i = 0; i < n; i++)
+        uart_putc(proto_out[i]);
+}
+
+//===================================================
+// Method to acknowledge a frame with a status
+//===================================================
+void proto_ack(int seq, int status)
+{
+    unsigned char st = status;
+
+    proto_send(PROTO_ACK, seq, &st, 1);
+}
+
+//=====================================================================
+// Method to wait for a frame from the host
+// Returns 1 with the frame in proto_in, -1 for a damaged frame or 0
+// if the line goes quiet for timeout ticks
+//=====================================================================
+int proto_recv(unsigned long timeout)
+{
+    int c, r;
+
+    while((c = uart_getc(timeout)) >= 0)
+        if((r = proto_rx_byte(&proto_in, c)) != 0)
+            return r;
+    return 0;
+}
+
+//=====================================================================================
+// Method to send len bytes of the EEPROM from addr as data frames
+// Up to PROTO_WINDOW frames go out ahead of their acknowledgements, the EEPROM read of
+// each overlapping the transmission of the ones before. A NAK or a quiet line goes back
+// to the first unacknowledged frame, which is read from the EEPROM again.
+//=====================================================================================
+int proto_send_data(long addr, long len)
+{
+    unsigned char buf[PROTO_DATA];
+    long frames = (len + PROTO_DATA - 1) / PROTO_DATA, base = 0, next = 0, d;
+    int n, r, status;
+
+    while(base < frames)
+    {
+        while(next < frames && next < base + PROTO_WINDOW)
+        {
+            n = len - next * PROTO_DATA > PROTO_DATA ? PROTO_DATA : len - next * PROTO_DATA;
+            status = eeprom_read(addr + next * PROTO_DATA, buf, n);
+            if(status != IIC_OK)
+            {
+                proto_ack(next & 0xFF, status);
+                return status;
+            }
+            proto_send(PROTO_DATA_FRAME, next & 0xFF, buf, n);
+            next++;
+        }
+
+        r = proto_recv(PROTO_TIMEOUT);
+        if(r == 0)
+            next = base;
+        if(r != 1)
+            continue;
+
+        d = (proto_in.buf[2] - base) & 0xFF;        // Frames past base the SEQ refers to
+        if(proto_in.buf[1] == PROTO_ACK && d < next - base)
+            base += d + 1;
+        else if(proto_in.buf[1] == PROTO_NAK && d <= next - base)
+            next = base += d;
+        else if(proto_in.buf[1] == PROTO_QUIT)
+            return IIC_ERR_NACK;
+    }
+    return IIC_OK;
+}
+
+//===================================================
+// Method to fill a range of the EEPROM with 0xFF
+//===================================================
+int proto_erase(long addr, long len)
+{
+    unsigned char ff[EEPROM_PAGE_SIZE];
+    int n, status = IIC_OK;
+
+    memset(ff, 0xFF, sizeof(ff));
+    while(len > 0 && status == IIC_OK)
+    {
+        n = EEPROM_PAGE_SIZE - (addr & (EEPROM_PAGE_SIZE - 1));
+        if(n > len)
+            n = len;
+        status = eeprom_write(addr, ff, n);
+        addr += n;
+        len -= n;
+    }
+    return status;
+}
+
+//=====================================================================================
+// Method to serve the host link until the host sends PROTO_QUIT
+// Write frames are taken in SEQ order: a repeat of one already written is acknowledged
+// again, anything else out of order gets one NAK for the SEQ expected. The ACIA keeps
+// receiving the next frames into uart_rx while the EEPROM page of this one is written.
+//=====================================================================================
+void HostLink(void)
+{
+    unsigned char buf[PROTO_DATA];
+    unsigned char *p;
+    int r, cmd, seq, plen, status, expect = 0, nak_sent = 0;
+    unsigned long crc;
+
+    proto_rx_init(&proto_in);
+    while(1)
+    {
+        r = proto_recv(PROTO_TIMEOUT);
+        if(r == 0)
+            continue;
+        if(r < 0)
+        {
+            if(!nak_sent)
+                proto_send(PROTO_NAK, expect, 0, 0);
+            nak_sent = 1;
+            continue;
+        }
+
+        cmd = proto_in.buf[1];
+        seq = proto_in.buf[2];
+        p = proto_in.buf + 3;
+        plen = proto_in.len - 2;
+        if(cmd != PROTO_WRITE)
+            expect = 0;             // The next run of writes starts again from SEQ 0
+
+        if(cmd == PROTO_WRITE)
+        {
+            if(seq == expect && plen > 3)
+            {
+                status = eeprom_write(proto_get24(p), p + 3, plen - 3);
+                proto_ack(seq, status);
+                expect = (expect + 1) & 0xFF;
+                nak_sent = 0;
+            }
+            else if(((expect - seq) & 0xFF) <= PROTO_WINDOW)
+                proto_ack(seq, IIC_OK);
+            else if(!nak_sent)
+            {
+                proto_send(PROTO_NAK, expect, 0, 0);
+                nak_sent = 1;
+            }
+        }
+        else if(cmd == PROTO_READ && plen == 6)
+            proto_send_data(proto_get24(p), proto_get24(p + 3));
+        else if(cmd == PROTO_VERIFY && plen == 10)
+        {
+            crc = 0;
+            status = eeprom_read_stream(proto_get24(p), proto_get24(p + 3), buf, sizeof(buf), crc32_chunk, &crc);
+            if(status == IIC_OK && crc != proto_get32(p + 6))
+                status = IIC_ERR_CRC;
+            proto_ack(seq, status);
+        }
+        else if(cmd == PROTO_ERASE && plen == 6)
+            proto_ack(seq, proto_erase(proto_get24(p), proto_get24(p + 3)));
+        else if(cmd == PROTO_QUIT)
+        {
+            proto_ack(seq, IIC_OK);
+            uart_flush();
+            return;
+        }
+        else
+            proto_ack(seq, IIC_ERR_RANGE);
+    }
+}
+
+//=====================================================================================
+// Method to read one Motorola S-record or Intel HEX record from the serial port
+// Skips anything before the 'S' or ':' that starts a record, then collects the digits up
+// to the end of the line and decodes them in one pass with hex_decode(). base holds the
+// Intel HEX extended address between calls. Returns LOAD_DATA with the record in addr,
+// data and len, LOAD_SKIP, LOAD_END, or IIC_ERR_CRC if the record has a bad character,
+// the wrong length or the wrong checksum.
+//=====================================================================================
+int load_record(long *addr, unsigned char *data, int *len, long *base)
+{
+    char line[LOAD_LINE];
+    unsigned char rec[LOAD_LINE / 2];
+    unsigned char sum = 0;
+    int c, srec, type = 0, n = 0, bytes, size, i;
+
+    do
+    {
+        c = _getch();
+        if(c == 'q' || c == 'Q')
+            return LOAD_END;
+    }
+    while(c != 'S' && c != ':');
+
+    srec = c == 'S';
+    if(srec)
+        type = _getch() - '0';
+    while(n < LOAD_LINE && (c = _getch()) != '\r' && c != '\n')
+        line[n++] = c;
+
+    bytes = n / 2;
+    if(type < 0 || type > 9 || bytes < 2 || hex_decode(line, rec, bytes) < 0)
+        return IIC_ERR_CRC;
+    for(i = 0; i < bytes; i++)
+        sum += rec[i];
+
+    if(srec)
+    {
+        // Count, address, data, checksum; the count covers everything after itself
+        size = (type <= 1 || type == 5 || type == 9) ? 2 : (type == 2 || type == 6 || type == 8) ? 3 : 4;
+        if(rec[0] != bytes - 1 || rec[0] < size + 1)
+            return IIC_ERR_CRC;
+        if(sum != 0xFF)                 // Checksum is the ones complement of the sum
+            return IIC_ERR_CRC;
+        for(*addr = 0, i = 1; i <= size; i++)
+            *addr = (*addr << 8) | rec[i];
+        *len = rec[0] - size - 1;
+        for(i = 0; i < *len; i++)
+            data[i] = rec[1 + size + i];
+        if(type >= 7)
+            return LOAD_END;
+        return (type >= 1 && type <= 3) ? LOAD_DATA : LOAD_SKIP;
+    }
+
+    // Count, address, type, data, checksum; the count is of the data only
+    if(bytes < 5 || rec[0] != bytes - 5)
+        return IIC_ERR_CRC;
+    if(sum != 0)                        // Checksum is the twos complement of the sum
+        return IIC_ERR_CRC;
+    *addr = (rec[1] << 8) | rec[2];
+    type = rec[3];
+    *len = rec[0];
+    for(i = 0; i < *len; i++)
+        data[i] = rec[4 + i];
+    if(type == 1)
+        return LOAD_END;
+    if(type == 2 && *len == 2)
+        *base = ((long)data[0] << 12) | ((long)data[1] << 4);     // Segment, times 16
+    else if(type == 4 && *len == 2)
+        *base = ((long)data[0] << 24) | ((long)data[1] << 16);    // Upper 16 bits
+    if(type != 0)
+        return LOAD_SKIP;
+    *addr += *base;
+    return LOAD_DATA;
+}
+
+//=====================================================================================
+// Method to program the EEPROM from S-records or Intel HEX sent over the serial port
+// Records are staged with eeprom_update(), each page is written as soon as it is full
+// and the partial pages at the end by eeprom_commit(). With verify set nothing is
+// written, the records are compared with the EEPROM instead.
+//=====================================================================================
+void Load(int verify)
+{
+    unsigned char data[255], buf[255];
+    long addr, base = 0, bytes = 0, records = 0, bad = 0, range = 0, mismatches = 0;
+    unsigned long start, elapsed;
+    int r, len, i, status = IIC_OK;
+
+    printf("\nSend the S-record or Intel HEX file now, it ends at the end record or 'q'.\n");
+    start = ticks();
+    while(status == IIC_OK && (r = load_record(&addr, data, &len, &base)) != LOAD_END)
+    {
+        if(r == IIC_ERR_CRC)
+            bad++;
+        if(r != LOAD_DATA)
+            continue;
+        records++;
+        if(addr < 0 || addr + len > EEPROM_SIZE)
+        {
+            range++;
+            continue;
+        }
+        bytes += len;
+
+        if(verify)
+        {
+            status = eeprom_read(addr, buf, len);
+            for(i = 0; i < len; i++)
+                if(buf[i] != data[i])
+                    mismatches++;
+        }
+        else
+        {
+            status = eeprom_update(addr, data, len);
+            if(status == IIC_OK)
+                status = update_commit_full();
+        }
+    }
+    if(!verify && status == IIC_OK)
+        status = eeprom_commit();
+    elapsed = ticks() - start;
+
+    printf("\nload records=%ld bytes=%ld bad_records=%ld out_of_range=%ld mismatches=%ld status=%d ticks=%lu bytes_per_s=%lu\n",
+           records, bytes, bad, range, mismatches, status, elapsed, per_sec(bytes, elapsed));
+}
+
+//===================================================
+// Method to move a range of the EEPROM, see eeprom_move()
+//===================================================
+void Move(void)
+{
+    int src, dst, size, status;
+    unsigned long t0, elapsed;
+
+    printf("\nPlease enter the source address in the Hex format XXXXXX: \n");
+    src = Get6HexDigits(0);
+    printf("\nPlease enter the destination address in the Hex format XXXXXX: \n");
+    dst = Get6HexDigits(0);
+    printf("\nPlease enter the number of bytes in the Hex format XXXXXX: \n");
+    size = Get6HexDigits(0);
+
+    t0 = ticks();
+    status = eeprom_move(dst, src, size);
+    elapsed = ticks() - t0;
+    if(status != IIC_OK)
+        printf("\nMove failed with status %d\n", status);
+    else
+        printf("\nMoved %#X bytes from %#X to %#X in %lu ticks, %lu bytes/s\n", size, src, dst, elapsed, per_sec(size, elapsed));
+}
+
+//===================================================
+// Method to display menu for EEProm chip functions
+//===================================================
+void EEPROM(void)
+{
+    
+    int mode = 0, addr = 0, size = 0, data = 0, valid = 0, i = 0;
+    int endAddr, blockSelect;
+
+    while(!valid)
+    {
+        printf("\nPlease select a mode by entering a number. \n1: Write byte\n2: Write page\n3: Read byte\n4: Read page\n5: Load S-records / Intel HEX\n6: Verify S-records / Intel HEX\n7: Move\n");
+        //mode = _getch();
+        scanf("%d", &mode);
+
+        if(mode > 0 && mode < 8) valid = 1;
+        else
+        {
+            printf("\nYou selected an invalid option. Please enter a number between 1 and 7.\n\n");
+        }
+    }
+
+    if(mode == 5 || mode == 6)
+    {
+        Load(mode == 6);
+        return;
+    }
+    if(mode == 7)
+    {
+        Move();
+        return;
     }
 
     valid = 0;
@@ -762,64 +3920,530 @@ void EEPROM(void)
     {
         printf("Reading %#X blocks, starting from address %#X.\n", size, addr);
 
-        endAddr = addr + size;
-        if(addr < 0x010000 && endAddr > 0x0FFFF)           // We are crossing 64K boundary of EEPROM, we will need to toggle Block select at 0x01_0000
-            blockSelect = 2;
-        else if (addr < 0x010000 && endAddr < 0x010000)     // We are only writing to the LOWER 64K bytes of EEPROM, so Block select = 0
-            blockSelect = 0;
-        else if (addr > 0x0FFFF && endAddr > 0x0FFFF && endAddr < 0x1FFFF)     // We are only writing to the UPPER 64K bytes of EEPROM, so Block select = 1
-            blockSelect = 1;
-        else if(addr > 0x0FFFF && endAddr > 0x1FFFF)
-            blockSelect = 3;
-        else
-            printf("There was an error when setting the blockSelect variable - ^Line 321^\n");
-
-        read_page(addr, size, blockSelect);
-        blockSelect = 0;
+        read_page(addr, size);
         printf("\n");
     }
     return;
 }
 
+//=====================================================================================
+// Done callback of the ADC acquisition descriptors, runs in the I2C ISR
+// Moves the block into adc_ring a frame at a time, then queues the descriptor behind
+// the other one so the sequential read never ends while adc_running is set.
+//=====================================================================================
+void adc_block_done(struct iic_xfer *x)
+{
+    int i;
+
+    if(x->status != IIC_OK)
+    {
+        adc_errors++;
+        adc_running = 0;
+        return;
+    }
+
+    adc_samples += x->rlen;
+    for(i = 0; i < x->rlen; i += ADC_FRAME)
+        ring_put(&adc_ring, x->rbuf + i, ADC_FRAME);
+
+    if(adc_running)
+    {
+        x->wlen = 0;
+        x->flags = XFER_CONTINUE;
+        xfer_requeue(x);
+    }
+}
+
+//=====================================================================
+// Method to restart ADC acquisition after adc_stop()
+// The first descriptor sends the control byte, after that the two
+// descriptors take turns carrying on the same sequential read.
+// Frames already in adc_ring are kept.
+//=====================================================================
+void adc_resume(void)
+{
+    int i;
+
+    for(i = 0; i < 2; i++)
+    {
+        xfer_setup(&adc_xfer[i], ADCDAC_ADDR, 0, 0, adc_block[i], ADC_BLOCK);
+        adc_xfer[i].flags = XFER_CONTINUE;
+        adc_xfer[i].done = adc_block_done;
+    }
+    adc_xfer[0].wbuf = &adc_control;
+    adc_xfer[0].wlen = 1;
+    adc_xfer[0].flags = 0;
+    adc_xfer[0].next = &adc_xfer[1];
+
+    adc_running = 1;
+    iic_submit_list(&adc_xfer[0]);
+}
+
 //===================================================
-// Method to display analog data from DAC on LED
+// Method to start continuous ADC acquisition into an empty adc_ring
 //===================================================
-void DAC(void)
+void adc_start(void)
 {
-    int i = 0, d = 0, scalar = 100;
-    int flip = 0;
+    ring_init(&adc_ring, adc_ring_buf, ADC_RING_SIZE);
+    adc_samples = 0;
+    adc_errors = 0;
+    adc_resume();
+}
 
-    //Send start and slave address, read mode
-    send((ADCDAC_ADDR << 1) + 0, STA);
+//=====================================================================
+// Method to stop continuous ADC acquisition
+// The descriptor in progress NACKs its last byte and stops the bus
+//=====================================================================
+void adc_stop(void)
+{
+    adc_running = 0;
+    iic_wait(&adc_xfer[0]);
+    iic_wait(&adc_xfer[1]);
+}
 
-    //Send control byte
-    send(0x43, NOP);//0b01000011  0, Enable output, single-ended input,,0, don't increment, channel 3,,
+//=====================================================================
+// Method to convert a thermistor count to 0.1 degrees C
+// Linear interpolation between therm_table entries, integers only
+//=====================================================================
+int therm_decidegrees(int count)
+{
+    int i = (count >> SENSOR_SHIFT) & (SENSOR_POINTS - 2), frac = count & ((1 << SENSOR_SHIFT) - 1);
+
+    return therm_table[i] + (therm_table[i + 1] - therm_table[i]) * frac / (1 << SENSOR_SHIFT);
+}
+
+//===================================================
+// Method to convert a photo resistor count to lux
+//===================================================
+unsigned int light_lux(int count)
+{
+    int i = (count >> SENSOR_SHIFT) & (SENSOR_POINTS - 2), frac = count & ((1 << SENSOR_SHIFT) - 1);
+
+    return lux_table[i] - ((lux_table[i] - lux_table[i + 1]) * (long)frac >> SENSOR_SHIFT);
+}
+
+//===================================================
+// Method to convert a potentiometer count to 0.1 percent
+//===================================================
+int pot_permille(int count)
+{
+    return ((long)count * 1000 + 127) / 255;
+}
+
+#ifdef IIC_SIM
+//=====================================================================
+// Floating point versions of the conversions, the reference the
+// tables were generated from. Host only, the 68K has no FPU.
+//=====================================================================
+double therm_float(int count)
+{
+    double r, lr;
+
+    count = count < 1 ? 1 : count > 255 ? 255 : count;
+    r = SENSOR_R_FIXED * count / (256 - count);
+    lr = log(r);
+    return 1.0 / (1.009249522e-3 + 2.378405444e-4 * lr + 2.019202697e-7 * lr * lr * lr) - 273.15;
+}
+
+double lux_float(int count)
+{
+    double r;
+
+    count = count < 1 ? 1 : count > 255 ? 255 : count;
+    r = SENSOR_R_FIXED * count / (256 - count);
+    return 10.0 * pow(10000.0 / r, 1.0 / 0.7);
+}
+
+double pot_float(int count)
+{
+    return count * 100.0 / 255.0;
+}
+#endif
+
+//=====================================================================
+// Method to set up a filter
+// taps is the moving average length or the number of coef, shift the
+// IIR smoothing. Produces one output for every decimate inputs.
+//=====================================================================
+void filter_init(struct filter *f, int type, int taps, int shift, const short *coef, int decimate)
+{
+    int i;
+
+    f->type = type;
+    f->taps = taps < 1 ? 1 : taps > FILTER_MAX_TAPS ? FILTER_MAX_TAPS : taps;
+    f->shift = shift;
+    f->coef = coef;
+    f->decimate = decimate < 1 ? 1 : decimate;
+    f->phase = 0;
+    f->acc = 0;
+    f->pos = 0;
+    for(i = 0; i < 2 * FILTER_MAX_TAPS; i++)
+        f->hist[i] = 0;
+}
+
+//=====================================================================================
+// Method to filter a block of samples
+// Takes n samples from in, stride bytes apart so one channel can be filtered straight
+// out of interleaved frames, and writes one output to out for every decimate inputs.
+// Only the state update runs per input; the division or FIR sum runs per output, so
+// decimating also saves the work of the outputs that would be thrown away.
+// Returns the number of outputs written.
+//=====================================================================================
+int filter_block(struct filter *f, unsigned char *in, int stride, int n, int *out)
+{
+    int i, k, x, outs = 0;
+    long acc;
+    int *h;
 
-    while (((char)(RS232_Status) & (char)(0x01)) != (char)(0x01)) // Check for any character being pressed
+    for(i = 0; i < n; i++, in += stride)
     {
-        send(d, NOP);
-        i++;
-        if(i%scalar == 0)
+        x = *in;
+        if(f->type == FILTER_IIR)
+            f->acc += (((long)x << 8) - f->acc) >> f->shift;
+        else
         {
-            if(d>=0xFF) {
-                flip = 1;
-            }
-            else if(d<=0x0){
-                flip = 0;
-            }
+            if(f->type == FILTER_MOVING)
+                f->acc += x - f->hist[f->pos];
+            f->hist[f->pos] = x;
+            f->hist[f->pos + f->taps] = x;
+            if(++f->pos == f->taps)
+                f->pos = 0;
+        }
 
-            if(flip) {
-                d--;
-            }
-            else if(!flip){
-                d++;
-            }
+        if(++f->phase < f->decimate)
+            continue;
+        f->phase = 0;
+
+        if(f->type == FILTER_IIR)
+            out[outs++] = (f->acc + 0x80) >> 8;
+        else if(f->type == FILTER_MOVING)
+            out[outs++] = (f->acc + f->taps / 2) / f->taps;
+        else
+        {
+            // hist[pos .. pos + taps - 1] is oldest to newest without wrapping
+            h = &f->hist[f->pos];
+            acc = 0;
+            for(k = 0; k < f->taps; k++)
+                acc += (long)f->coef[f->taps - 1 - k] * h[k];
+            out[outs++] = (acc + 0x4000) >> 15;
+        }
+    }
+    return outs;
+}
+
+//===================================================
+// Method to show one frame of sensor data in units
+//===================================================
+void sensor_show(int potent, int photo, int therm)
+{
+    int t = therm_decidegrees(therm), p = pot_permille(potent);
+
+    printf("Light: %5u lux\t Potentiometer: %3d.%d%%\t Temperature: %s%d.%d C   \r",
+           light_lux(photo), p / 10, p % 10, t < 0 ? "-" : "", (t < 0 ? -t : t) / 10, (t < 0 ? -t : t) % 10);
+}
+
+//=====================================================================================
+// Method to sample the ADC continuously and show the data as it is consumed
+// mode ADC_FORWARD shows every frame, ADC_AVERAGE the mean of each n frames and
+// ADC_DECIMATE every nth frame. Acquisition runs from the ISR, so a slow console only
+// shows up in the overflow count, not in the sample rate.
+//=====================================================================================
+void ADCStream(int mode, int n)
+{
+    unsigned char frame[ADC_FRAME];
+    unsigned long sum[ADC_FRAME], start, elapsed, frames = 0, shown = 0;
+    int i, count = 0;
+
+    if(n < 1 || mode == ADC_FORWARD)
+        n = 1;
+    for(i = 0; i < ADC_FRAME; i++)
+        sum[i] = 0;
+
+    start = ticks();
+    adc_start();
+    while(!kbhit() && adc_running)
+    {
+        if(!ring_get(&adc_ring, frame, ADC_FRAME))
+        {
+            CPU_IDLE();
+            continue;
+        }
+        frames++;
+        count++;
+        for(i = 0; i < ADC_FRAME; i++)
+            sum[i] = (mode == ADC_AVERAGE) ? sum[i] + frame[i] : frame[i];
+        if(count < n)
+            continue;
+
+        for(i = 0; i < ADC_FRAME; i++)
+            sum[i] = (mode == ADC_AVERAGE) ? sum[i] / n : sum[i];
+        sensor_show((int)sum[0], (int)sum[1], (int)sum[2]);
+        shown++;
+        count = 0;
+        for(i = 0; i < ADC_FRAME; i++)
+            sum[i] = 0;
+    }
+    adc_stop();
+    elapsed = ticks() - start;
+
+    printf("\nadc samples=%lu frames=%lu shown=%lu overflows=%lu errors=%lu ticks=%lu samples_per_s=%lu\n",
+           adc_samples, frames, shown, adc_ring.overflows / ADC_FRAME, adc_errors, elapsed, per_sec(adc_samples, elapsed));
+}
+
+//=====================================================================================
+// Method to sample the ADC continuously through a filter on each channel
+// Pulls ADC_BLOCK bytes at a time from adc_ring and filters each channel straight out
+// of the interleaved frames, keeping one output for every n frames.
+//=====================================================================================
+void ADCFilter(int type, int n)
+{
+    unsigned char block[ADC_BLOCK];
+    int out[ADC_FRAME][ADC_BLOCK / ADC_FRAME];
+    unsigned long start, elapsed, frames = 0, shown = 0;
+    int i, outs = 0;
+
+    for(i = 0; i < ADC_FRAME; i++)
+        filter_init(&adc_filters[i], type, type == FILTER_FIR ? sizeof(fir_lowpass) / sizeof(fir_lowpass[0]) : FILTER_AVG_TAPS,
+                    FILTER_IIR_SHIFT, fir_lowpass, n);
+
+    start = ticks();
+    adc_start();
+    while(!kbhit() && adc_running)
+    {
+        if(!ring_get(&adc_ring, block, ADC_BLOCK))
+        {
+            CPU_IDLE();
+            continue;
+        }
+        frames += ADC_BLOCK / ADC_FRAME;
+        for(i = 0; i < ADC_FRAME; i++)
+            outs = filter_block(&adc_filters[i], block + i, ADC_FRAME, ADC_BLOCK / ADC_FRAME, out[i]);
+        if(outs)
+        {
+            sensor_show(out[0][outs - 1], out[1][outs - 1], out[2][outs - 1]);
+            shown += outs;
+        }
+    }
+    adc_stop();
+    elapsed = ticks() - start;
+
+    printf("\nadc samples=%lu frames=%lu filtered=%lu overflows=%lu errors=%lu ticks=%lu samples_per_s=%lu\n",
+           adc_samples, frames, shown, adc_ring.overflows / ADC_FRAME, adc_errors, elapsed, per_sec(adc_samples, elapsed));
+}
+
+//=====================================================================
+// Method to write a sensor log block to the EEPROM during acquisition
+// The block, at most a page, goes through iic_batch_run() as one page
+// write per page it touches. On the ADC's bus the acquisition is
+// stopped for the write and resumed after it, on a separate bus it
+// carries on.
+//=====================================================================
+int slog_eeprom_write(int addr, unsigned char *buf, int size)
+{
+    static struct iic_xfer x[2];
+    int n, status, shared = iic_slave_bus(ADCDAC_ADDR) == iic_slave_bus(EEPROM_ADDR_LOWER);
+
+    if(addr < 0 || size < 1 || size > EEPROM_PAGE_SIZE || addr + size > EEPROM_SIZE)
+        return IIC_ERR_RANGE;
+
+    n = EEPROM_PAGE_SIZE - (addr & (EEPROM_PAGE_SIZE - 1));
+    if(n > size)
+        n = size;
+    xfer_eeprom(&x[0], addr, buf, n, 0);
+    iic_batch_add(&x[0]);
+    if(n < size)
+    {
+        xfer_eeprom(&x[1], addr + n, buf + n, size - n, 0);
+        iic_batch_add(&x[1]);
+    }
+
+    if(shared)
+        adc_stop();
+    iic_batch_run();
+    status = iic_wait(&x[0]);
+    eeprom_write_cycles++;
+    if(n < size)
+    {
+        if(iic_wait(&x[1]) != IIC_OK && status == IIC_OK)
+            status = x[1].status;
+        eeprom_write_cycles++;
+    }
+    if(shared)
+        adc_resume();
+    return status;
+}
+
+//=====================================================================================
+// Method to log the sensors to the EEPROM until a key is pressed or the log is full
+//=====================================================================================
+void SensorLog(int addr, int pages)
+{
+    unsigned char frame[ADC_FRAME];
+    unsigned long start, elapsed, frames = 0;
+    int status = IIC_OK;
+
+    slog_create(&sensor_log, addr, pages, eeprom_read, slog_eeprom_write);
+    start = ticks();
+    adc_start();
+    while(!kbhit() && adc_running && status == IIC_OK)
+    {
+        if(!ring_get(&adc_ring, frame, ADC_FRAME))
+        {
+            CPU_IDLE();
+            continue;
+        }
+        status = slog_add(&sensor_log, frame);
+        if(status == IIC_OK)
+            frames++;
+    }
+    adc_stop();
+    if(status == IIC_OK)
+    {
+        sensor_log.io = eeprom_write;
+        status = slog_flush(&sensor_log);
+    }
+    elapsed = ticks() - start;
+
+    printf("\nslog frames=%lu blocks=%d bytes=%lu status=%d overflows=%lu ticks=%lu frames_per_s=%lu\n", frames, sensor_log.block,
+           sensor_log.bytes, status, adc_ring.overflows / ADC_FRAME, elapsed, per_sec(frames, elapsed));
+}
+
+//===================================================
+// Method to print the sensor log, one frame per line
+//===================================================
+void SensorLogPrint(int addr, int pages)
+{
+    unsigned char frame[SLOG_CHANNELS];
+    int status;
+
+    slog_open(&sensor_log, addr, pages, eeprom_read);
+    while((status = slog_next(&sensor_log, frame)) == 1)
+        printf("%d,%d,%d\n", frame[0], frame[1], frame[2]);
+    if(status != 0)
+        printf("\nBlock %d of the log is damaged.\n", sensor_log.block);
+}
+
+//=====================================================================
+// Method to fill wave_table with one period of a waveform
+// WAVE_USER reads the table from WAVE_SIZE bytes of the EEPROM at addr
+//=====================================================================
+int wave_load(int shape, int addr)
+{
+    int i;
+
+    for(i = 0; i < WAVE_SIZE; i++)
+    {
+        if(shape == WAVE_SINE)
+        {
+            if(i < 64)
+                wave_table[i] = 128 + sine_quarter[i];
+            else if(i < 128)
+                wave_table[i] = 128 + sine_quarter[128 - i];
+            else if(i < 192)
+                wave_table[i] = 128 - sine_quarter[i - 128];
+            else
+                wave_table[i] = 128 - sine_quarter[256 - i];
+        }
+        else if(shape == WAVE_TRIANGLE)
+            wave_table[i] = i < 128 ? i * 2 : (255 - i) * 2 + 1;
+        else
+            wave_table[i] = i;
+    }
+
+    if(shape == WAVE_USER)
+        return eeprom_read(addr, wave_table, WAVE_SIZE);
+    return IIC_OK;
+}
+
+//=====================================================================
+// Method to work out the phase step for a frequency
+// rate is samples per second, the step is hz / rate of a 2^32 turn
+//=====================================================================
+unsigned long wave_step(unsigned long hz, unsigned long rate)
+{
+    unsigned long whole, rem;
+
+    if(rate == 0 || hz >= rate || hz > 0xFFFF)
+        return 0;
+    whole = (hz << 16) / rate;
+    rem = (hz << 16) % rate;
+    return (whole << 16) + (rem << 16) / rate;
+}
+
+//=====================================================================================
+// Method to stream wave_table to the DAC until a key is pressed, or if limit isn't 0
+// until limit samples have gone (rounded up to WAVE_BLOCK)
+// One write transaction carries every sample. The phase accumulator picks each sample,
+// so the frequency doesn't depend on the table size, and the next sample is loaded into
+// TXR while the previous one is still shifting out. Returns the samples sent.
+//=====================================================================================
+unsigned long wave_run(unsigned long step, unsigned long limit)
+{
+    unsigned long phase = 0, samples = 0;
+    struct iic_bus *bus = iic_slave_bus(ADCDAC_ADDR);
+    int i;
+
+    iic_select_speed(ADCDAC_ADDR);
+    send(bus, (ADCDAC_ADDR << 1) + 0, STA);
+    send(bus, DAC_CONTROL, NOP);
+
+    while(!(SR(bus) & 0x80) && (limit ? samples < limit : !kbhit()))
+    {
+        for(i = 0; i < WAVE_BLOCK; i++)
+        {
+            TXR(bus) = wave_table[(phase >> 24) & (WAVE_SIZE - 1)];
+            phase += step;
+            while(SR(bus) & 0x02)   // Wait for the previous sample to finish
+                STAT_COUNT(ready_spins, 1);
+            CR(bus) = 0x10;         // Write mode
+        }
+        samples += WAVE_BLOCK;
+        STAT_COUNT(bytes_out, WAVE_BLOCK);
+    }
+    ready(bus);
+    CR(bus) = 0x41;      // Stop cond, clear IF
+    STAT_STOP(bus);
+    ready(bus);
+
+    return samples;
+}
+
+//===================================================
+// Method to display analog data from DAC on LED
+//===================================================
+void DAC(void)
+{
+    int shape = 0, addr = 0;
+    unsigned long hz = 0, rate, step, samples, start, elapsed;
 
-        }
+    printf("\nWaveform: 1: Sine 2: Triangle 3: Sawtooth 4: Table from EEPROM\n");
+    scanf("%d", &shape);
+    if(shape == WAVE_USER)
+    {
+        printf("\nEEPROM address of the %d byte table: \n", WAVE_SIZE);
+        scanf("%x", &addr);
     }
-    send(0, STO);
+    printf("\nFrequency in Hz: \n");
+    scanf("%lu", &hz);
 
-    return;
+    if(wave_load(shape, addr) != IIC_OK)
+    {
+        printf("\nCouldn't read the table from the EEPROM.\n");
+        return;
+    }
+
+    // Each sample is 9 SCL cycles (8 data bits and the ACK)
+    rate = iic_slave_speed(ADCDAC_ADDR) / 9;
+    step = wave_step(hz, rate);
+    printf("\nPress any key to exit.\n");
+
+    start = ticks();
+    samples = wave_run(step, 0);
+    elapsed = ticks() - start;
+
+    rate = per_sec(samples, elapsed);
+    printf("\ndac samples=%lu ticks=%lu samples_per_s=%lu hz=%lu\n", samples, elapsed, rate,
+           (rate * (step >> 16)) >> 16);
 }
 
 //===================================================
@@ -827,41 +4451,44 @@ void DAC(void)
 //===================================================
 void ADC( void )
 {
+    struct iic_bus *bus = iic_slave_bus(ADCDAC_ADDR);
     int count = 0;
     int potent = 0, therm = 0, photo = 0;
     volatile int i;
 
     //Is control byte needed? Unclear
 
+    iic_select_speed(ADCDAC_ADDR);
+
     //Send start and slave address, read mode
-    send((ADCDAC_ADDR << 1) + 0, STA);
+    send(bus, (ADCDAC_ADDR << 1) + 0, STA);
 
     //Send control byte
 
     // For using the photosensor WORKS
-    send(0x46, NOP);//0b0100_0110  AOUT = Enabled(1), AINPUT = 0, Auto-increment=on, A/D channel = 01 (Potentiometer)
+    send(bus, 0x46, NOP);//0b0100_0110  AOUT = Enabled(1), AINPUT = 0, Auto-increment=on, A/D channel = 01 (Potentiometer)
 
     // For reading the potentiometer WORKS 0x41
-    //send(0x41, NOP);    //0b0101_0001, AOUT = Enabled(1), AIN = channel 1, Auto-increment=off, A/D channel = 01
+    //send(bus, 0x41, NOP);    //0b0101_0001, AOUT = Enabled(1), AIN = channel 1, Auto-increment=off, A/D channel = 01
 
     // For reading the thermistor, 0x43
-    //send(0x43, NOP);    //0b0101_0001, AOUT = Enabled(1), AIN = channel 0, Auto-increment=off, A/D channel = 10
+    //send(bus, 0x43, NOP);    //0b0101_0001, AOUT = Enabled(1), AIN = channel 0, Auto-increment=off, A/D channel = 10
 
     //Send start and slave address, read mode
-    send((ADCDAC_ADDR << 1) + 1, STA);
+    send(bus, (ADCDAC_ADDR << 1) + 1, STA);
     
     //Read analog data
-    while (((char)(RS232_Status) & (char)(0x01)) != (char)(0x01)) // Check for any character being pressed
+    while(!kbhit()) // Check for any character being pressed
     {
         
-        potent = page_ack(NOP);
-        photo = page_ack(NOP);
-        therm = page_ack(NOP);
-        page_ack(NOP); 
+        potent = page_ack(bus, NOP);
+        photo = page_ack(bus, NOP);
+        therm = page_ack(bus, NOP);
+        page_ack(bus, NOP); 
         printf("Photo resistor: %d\t Potentiometer: %d\t Thermistor: %d\r", photo, potent, therm);
 
     }
-    page_ack(NACK); // Tell ADC we're done
+    page_ack(bus, NACK); // Tell ADC we're done
 }
 
 //=======================================================
@@ -869,12 +4496,12 @@ void ADC( void )
 //========================================================
 void ADCDAC(void)   //Lets users choose ADC mode (read photo resistor) or DAC mode (output to LED)
 {
-    int mode = 0, valid = 0;
+    int mode = 0, valid = 0, n = 1, type = FILTER_MOVING, addr;
     
     while(!valid)
     {
         valid = 1;
-        printf("\nPlease choose a mode.\n1: Read Sensors\n2: Display DAC on LED\n");
+        printf("\nPlease choose a mode.\n1: Read Sensors\n2: Display DAC on LED\n3: Continuous acquisition\n4: Log sensors to EEPROM\n5: Print sensor log\n");
         scanf("%d", &mode);
         
         if(mode == 1)
@@ -884,9 +4511,48 @@ void ADCDAC(void)   //Lets users choose ADC mode (read photo resistor) or DAC mo
         }
         else if(mode == 2)
         {
-            printf("\nDAC mode selected. Press any key to exit.\n");
+            printf("\nDAC mode selected.\n");
             DAC();
         }
+        else if(mode == 3)
+        {
+            printf("\nConsumer: 1: Forward 2: Average 3: Decimate 4: Filter\n");
+            scanf("%d", &mode);
+            if(mode == ADC_FILTER)
+            {
+                printf("\nFilter: 1: Moving average 2: IIR 3: FIR low pass\n");
+                scanf("%d", &type);
+            }
+            if(mode != ADC_FORWARD)
+            {
+                printf("\nFrames per output: \n");
+                scanf("%d", &n);
+            }
+            printf("\nAcquisition started. Press any key to exit.\n");
+            if(mode == ADC_FILTER)
+                ADCFilter(type, n);
+            else
+                ADCStream(mode, n);
+        }
+        else if(mode == 4 || mode == 5)
+        {
+            printf("\nPlease enter the log address in the Hex format XXXXXX: \n");
+            addr = Get6HexDigits(0) & ~(EEPROM_PAGE_SIZE - 1);
+            printf("\nPages in the log: \n");
+            scanf("%d", &n);
+            if(addr + (long)n * EEPROM_PAGE_SIZE > EEPROM_SIZE || n < 1)
+            {
+                printf("\nThe log doesn't fit in the EEPROM.\n");
+                valid = 0;
+            }
+            else if(mode == 4)
+            {
+                printf("\nLogging started. Press any key to exit.\n");
+                SensorLog(addr, n);
+            }
+            else
+                SensorLogPrint(addr, n);
+        }
         else
         {
             printf("\nYou have entered invalid input.\n");
@@ -896,23 +4562,1010 @@ void ADCDAC(void)   //Lets users choose ADC mode (read photo resistor) or DAC mo
     }
 }
 
+//=======================================================
+// Method to let the user choose the EEPROM bus speed
+//========================================================
+void BusSpeed(void)
+{
+    struct iic_bus *bus = iic_slave_bus(EEPROM_ADDR_LOWER);
+    int khz = 0, i;
+    long pre;
+
+    printf("\nPlease enter the EEPROM SCL frequency in kHz (100 or 400): \n");
+    scanf("%d", &khz);
+
+    if(khz * 1000L > iic_slave_max_speed(EEPROM_ADDR_LOWER))
+    {
+        printf("\nThe EEPROM is rated up to %ld kHz.\n", iic_slave_max_speed(EEPROM_ADDR_LOWER) / 1000);
+        return;
+    }
+
+    pre = iic_prescale(bus->core_hz, khz * 1000L);
+    if(pre < 0)
+    {
+        printf("\n%d kHz can't be made from a %ld Hz core clock.\n", khz, bus->core_hz);
+        return;
+    }
+
+    for(i = 0; i < sizeof(iic_devices) / sizeof(iic_devices[0]); i++)
+        if(iic_devices[i].slave == EEPROM_ADDR_LOWER || iic_devices[i].slave == EEPROM_ADDR_UPPER)
+            iic_devices[i].scl_hz = khz * 1000L;
+
+    printf("\nPrescale %#lX, effective SCL %ld Hz on bus %d\n", pre, iic_effective_hz(bus->core_hz, pre), bus->id);
+}
+
+//=====================================================================
+// Method to time a CRC function over bytes of data
+// Prints one line of key=value pairs
+//=====================================================================
+void crc_bench_run(char *name, unsigned long (*crc_fn)(unsigned long, unsigned char *, int),
+                   unsigned char *buf, int len, long bytes)
+{
+    unsigned long start, elapsed, crc = 0;
+    long done;
+
+    start = ticks();
+    for(done = 0; done < bytes; done += len)
+        crc = crc_fn(crc, buf, len);
+    elapsed = ticks() - start;
+
+    printf("bench=%s bytes=%ld ticks=%lu bytes_per_s=%lu crc=%08lX\n", name, bytes, elapsed, per_sec(bytes, elapsed), crc);
+}
+
+//===================================================
+// CRC-16 wrappers with the same type as the CRC-32 functions
+//===================================================
+unsigned long crc16_bitwise_bench(unsigned long crc, unsigned char *buf, int len)
+{
+    return crc16_bitwise(crc, buf, len);
+}
+
+unsigned long crc16_table_bench(unsigned long crc, unsigned char *buf, int len)
+{
+    return crc16(crc, buf, len);
+}
+
+//===================================================
+// Method to compare the CRC variants
+//===================================================
+void crc_bench(void)
+{
+    unsigned char buf[1024];
+    int i;
+
+    for(i = 0; i < sizeof(buf); i++)
+        buf[i] = i * 7 + 3;
+
+    crc_bench_run("crc16_bitwise", crc16_bitwise_bench, buf, sizeof(buf), 65536L);
+    crc_bench_run("crc16_table", crc16_table_bench, buf, sizeof(buf), 65536L);
+    crc_bench_run("crc32_bitwise", crc32_bitwise, buf, sizeof(buf), 65536L);
+    crc_bench_run("crc32_bytewise", crc32_bytewise, buf, sizeof(buf), 65536L);
+#ifdef CRC_SLICE4
+    crc_bench_run("crc32_slice4", crc32_slice4, buf, sizeof(buf), 65536L);
+#endif
+}
+
+//=====================================================================
+// Method to time the sensor conversions
+// The host build also times the floating point versions and reports
+// the largest difference of the fixed point temperature from them
+// over the thermistor's useful range
+//=====================================================================
+void sensor_bench(void)
+{
+    unsigned long start, elapsed;
+    volatile long sink = 0;
+    long n;
+#ifdef IIC_SIM
+    volatile double fsink = 0;
+    double err, max_err = 0;
+    int c;
+#endif
+
+    start = ticks();
+    for(n = 0; n < SENSOR_BENCH; n++)
+        sink += therm_decidegrees(n & 0xFF) + light_lux(n & 0xFF) + pot_permille(n & 0xFF);
+    elapsed = ticks() - start;
+    printf("bench=sensor_fixed samples=%ld ticks=%lu samples_per_s=%lu\n", SENSOR_BENCH, elapsed, per_sec(SENSOR_BENCH, elapsed));
+
+#ifdef IIC_SIM
+    start = ticks();
+    for(n = 0; n < SENSOR_BENCH; n++)
+        fsink += therm_float(n & 0xFF) + lux_float(n & 0xFF) + pot_float(n & 0xFF);
+    elapsed = ticks() - start;
+    printf("bench=sensor_float samples=%ld ticks=%lu samples_per_s=%lu\n", SENSOR_BENCH, elapsed, per_sec(SENSOR_BENCH, elapsed));
+
+    // Counts 24 to 240 are about 95 to -35 C, past that the curve is too steep for 8 count steps
+    for(c = 24; c <= 240; c++)
+    {
+        err = fabs(therm_decidegrees(c) / 10.0 - therm_float(c));
+        if(err > max_err)
+            max_err = err;
+    }
+    printf("sensor_therm_max_err_c=%.2f\n", max_err);
+#endif
+}
+
+//=====================================================================
+// Method to find the largest difference of a filter from a direct
+// per-sample calculation, over a noisy step fed in uneven blocks
+//=====================================================================
+int filter_error(int type, int decimate)
+{
+    unsigned char in[96];
+    int out[96], i, j, n, outs = 0, err, max_err = 0, taps;
+    long acc;
+    struct filter f;
+
+    taps = type == FILTER_FIR ? sizeof(fir_lowpass) / sizeof(fir_lowpass[0]) : FILTER_AVG_TAPS;
+    for(i = 0; i < sizeof(in); i++)
+        in[i] = (i < 20 ? 10 : 200) + ((i * 37) & 15);
+    filter_init(&f, type, taps, FILTER_IIR_SHIFT, fir_lowpass, decimate);
+    for(i = 0; i < sizeof(in); i += n)
+    {
+        n = (i % 7) + 1;
+        if(i + n > sizeof(in))
+            n = sizeof(in) - i;
+        outs += filter_block(&f, in + i, 1, n, out + outs);
+    }
+
+    for(i = decimate - 1, j = 0; i < sizeof(in); i += decimate, j++)
+    {
+        if(type == FILTER_IIR)
+        {
+            // y[i] = y[i-1] + (x[i] - y[i-1]) / 2^shift, kept in Q8
+            for(acc = 0, n = 0; n <= i; n++)
+                acc += (((long)in[n] << 8) - acc) >> FILTER_IIR_SHIFT;
+            acc = (acc + 0x80) >> 8;
+        }
+        else if(type == FILTER_MOVING)
+        {
+            for(acc = 0, n = 0; n < taps && n <= i; n++)
+                acc += in[i - n];
+            acc = (acc + taps / 2) / taps;
+        }
+        else
+        {
+            for(acc = 0, n = 0; n < taps && n <= i; n++)
+                acc += (long)fir_lowpass[n] * in[i - n];
+            acc = (acc + 0x4000) >> 15;
+        }
+        err = out[j] - (int)acc;
+        err = err < 0 ? -err : err;
+        if(err > max_err)
+            max_err = err;
+    }
+    return j == outs ? max_err : 9999;
+}
+
+//=====================================================================
+// Method to time each filter with and without decimation
+// Also checks each against filter_error()
+//=====================================================================
+void filter_bench(void)
+{
+    static char *names[] = { "", "moving", "iir", "fir" };
+    unsigned char block[ADC_BLOCK];
+    int out[ADC_BLOCK], type, d, i;
+    unsigned long start, elapsed;
+    long n;
+    struct filter f;
+
+    for(i = 0; i < ADC_BLOCK; i++)
+        block[i] = i * 13;
+
+    for(type = FILTER_MOVING; type <= FILTER_FIR; type++)
+        for(d = 1; d <= 8; d += 7)
+        {
+            filter_init(&f, type, type == FILTER_FIR ? sizeof(fir_lowpass) / sizeof(fir_lowpass[0]) : FILTER_AVG_TAPS,
+                        FILTER_IIR_SHIFT, fir_lowpass, d);
+            start = ticks();
+            for(n = 0; n < FILTER_BENCH; n += ADC_BLOCK)
+                filter_block(&f, block, 1, ADC_BLOCK, out);
+            elapsed = ticks() - start;
+            printf("bench=filter_%s decimate=%d samples=%ld ticks=%lu samples_per_s=%lu max_err=%d\n", names[type], d,
+                   FILTER_BENCH, elapsed, per_sec(FILTER_BENCH, elapsed), filter_error(type, d));
+        }
+}
+
+//=====================================================================
+// Method to compress a trace into slog_ram and read it back
+// Prints the compression ratio and the time to encode and decode
+//=====================================================================
+void slog_bench_trace(char *name, unsigned char (*trace)[SLOG_CHANNELS], int n)
+{
+    unsigned char frame[SLOG_CHANNELS];
+    unsigned long start, encode, decode, raw = (unsigned long)n * SLOG_CHANNELS, ratio;
+    int i, count = 0, match = 1;
+
+    start = ticks();
+    slog_create(&sensor_log, 0, SLOG_RAM_PAGES, slog_ram_read, slog_ram_write);
+    for(i = 0; i < n; i++)
+        if(slog_add(&sensor_log, trace[i]) != IIC_OK)
+            break;
+    slog_flush(&sensor_log);
+    encode = ticks() - start;
+
+    start = ticks();
+    slog_open(&sensor_log, 0, SLOG_RAM_PAGES, slog_ram_read);
+    while(slog_next(&sensor_log, frame) == 1)
+    {
+        if(count >= n || memcmp(frame, trace[count], SLOG_CHANNELS))
+            match = 0;
+        count++;
+    }
+    decode = ticks() - start;
+
+    ratio = sensor_log.bytes ? raw * 100 / sensor_log.bytes : 0;
+    printf("bench=slog trace=%s frames=%d raw_bytes=%lu log_bytes=%lu ratio=%lu.%02lu bus_bytes_per_sample=%lu.%02lu "
+           "encode_ticks=%lu decode_ticks=%lu match=%d\n", name, n, raw, sensor_log.bytes, ratio / 100, ratio % 100,
+           sensor_log.bytes / raw, sensor_log.bytes * 100 / raw % 100, encode, decode, match && count == n);
+}
+
+//=====================================================================
+// Method to benchmark the sensor log format
+// Uses a trace recorded from the ADC and a synthetic noisy one
+//=====================================================================
+void slog_bench(void)
+{
+    static unsigned char trace[SLOG_BENCH_FRAMES][SLOG_CHANNELS];
+    unsigned char frame[ADC_FRAME];
+    unsigned long seed = 1;
+    int i = 0, c;
+
+    adc_start();
+    while(i < SLOG_BENCH_FRAMES && adc_running)
+    {
+        if(!ring_get(&adc_ring, frame, ADC_FRAME))
+            CPU_IDLE();
+        else
+            memcpy(trace[i++], frame, SLOG_CHANNELS);
+    }
+    adc_stop();
+    slog_bench_trace("adc", trace, i);
+
+    // Slow ramps with a few counts of noise
+    for(i = 0; i < SLOG_BENCH_FRAMES; i++)
+        for(c = 0; c < SLOG_CHANNELS; c++)
+        {
+            seed = seed * 1103515245 + 12345;
+            trace[i][c] = 64 * c + i / (16 << c) + ((seed >> 16) & 7);
+        }
+    slog_bench_trace("noisy", trace, SLOG_BENCH_FRAMES);
+}
+
+//=====================================================================
+// The original hex parsing, xtod_subtract() a nibble at a time, with
+// the same type as hex_decode() for hex_bench()
+//=====================================================================
+int hex_decode_subtract(const char *s, unsigned char *out, int bytes)
+{
+    int i;
+
+    for(i = 0; i < bytes; i++)
+        out[i] = (xtod_subtract(s[2 * i]) << 4) | xtod_subtract(s[2 * i + 1]);
+    return bytes;
+}
+
+//=====================================================================
+// Method to time a hex parser over HEX_BENCH bytes
+// Prints one line of key=value pairs, ok=1 if it decoded text to ref
+//=====================================================================
+void hex_bench_parse(char *name, int (*parse)(const char *, unsigned char *, int),
+                     char *text, unsigned char *ref, int len)
+{
+    unsigned char out[1024];
+    unsigned long start, elapsed;
+    long done;
+    int n = 0;
+
+    start = ticks();
+    for(done = 0; done < HEX_BENCH; done += len)
+        n = parse(text, out, len);
+    elapsed = ticks() - start;
+
+    printf("bench=%s bytes=%ld ticks=%lu bytes_per_s=%lu ok=%d\n", name, HEX_BENCH, elapsed,
+           per_sec(HEX_BENCH, elapsed), n == len && memcmp(out, ref, len) == 0);
+}
+
+//=====================================================================
+// Method to time hex parsing and formatting
+// The old paths, compare and subtract a nibble at a time and sprintf()
+// a byte at a time, against hex_decode() and hex_format_line(). Output
+// goes to a buffer, so only the CPU time is measured.
+//=====================================================================
+void hex_bench(void)
+{
+    static char text[2 * 1024];
+    unsigned char bytes[1024];
+    char line[HEX_LINE_MAX + 1];
+    unsigned long start, elapsed;
+    volatile int sink = 0;
+    long done;
+    int i, j, n;
+
+    for(i = 0; i < sizeof(bytes); i++)
+    {
+        bytes[i] = i * 7 + 3;
+        text[2 * i] = hex_digits[bytes[i] >> 4];
+        text[2 * i + 1] = "0123456789abcdef"[bytes[i] & 0xF];   // Mixed case, as files arrive
+    }
+
+    hex_bench_parse("hex_parse_subtract", hex_decode_subtract, text, bytes, sizeof(bytes));
+    hex_bench_parse("hex_parse_table", hex_decode, text, bytes, sizeof(bytes));
+
+    start = ticks();
+    for(done = 0; done < HEX_BENCH; done += sizeof(bytes))
+        for(i = 0; i < sizeof(bytes); i += HEX_LINE_BYTES)
+        {
+            n = sprintf(line, "\n%05X:", i & 0x1FFFF);
+            for(j = 0; j < HEX_LINE_BYTES; j++)
+                n += sprintf(line + n, " %02X", bytes[i + j]);
+            sink += n;
+        }
+    elapsed = ticks() - start;
+    printf("bench=hex_dump_sprintf bytes=%ld ticks=%lu bytes_per_s=%lu\n", HEX_BENCH, elapsed, per_sec(HEX_BENCH, elapsed));
+
+    start = ticks();
+    for(done = 0; done < HEX_BENCH; done += sizeof(bytes))
+        for(i = 0; i < sizeof(bytes); i += HEX_LINE_BYTES)
+            sink += hex_format_line(line, i, bytes + i, HEX_LINE_BYTES);
+    elapsed = ticks() - start;
+    printf("bench=hex_dump_table bytes=%ld ticks=%lu bytes_per_s=%lu\n", HEX_BENCH, elapsed, per_sec(HEX_BENCH, elapsed));
+}
+
+//=====================================================================
+// Method to check the engine reports a NACK of the last byte written
+// The simulation makes the EEPROM NACK it, on the board it's skipped
+//=====================================================================
+void check_engine_nack(void)
+{
+#ifdef IIC_SIM
+    unsigned char data[2] = { 0x5A, 0xA5 }, byte;
+    struct iic_xfer x;
+    int nacked, clean;
+
+    eeprom_read(CHECK_ADDR, &byte, 1);      // Acknowledge polls, so the EEPROM is free
+
+    xfer_eeprom(&x, CHECK_ADDR, data, 2, 0);
+    sim_nack_write = 4;                     // Two address bytes, then the second data byte
+    iic_submit(&x);
+    nacked = iic_wait(&x);
+
+    eeprom_read(CHECK_ADDR, &byte, 1);
+    xfer_eeprom(&x, CHECK_ADDR, data, 2, 0);
+    iic_submit(&x);
+    clean = iic_wait(&x);
+
+    printf("bench=check_engine_nack last_byte=%d clean=%d match=%d\n", nacked, clean,
+           nacked == IIC_ERR_NACK && sim_nack_write == 0 && clean == IIC_OK);
+#endif
+}
+
+//=====================================================================
+// Method to check the engine acknowledge polls an EEPROM descriptor
+// queued behind a write, the read starts during the write cycle
+//=====================================================================
+void check_engine_poll(void)
+{
+    unsigned char data[4] = { 0x3C, 0xC3, 0x69, 0x96 }, back[4];
+    struct iic_xfer x[2];
+    int wrote, read;
+
+    xfer_eeprom(&x[0], CHECK_ADDR, data, 4, 0);
+    xfer_eeprom(&x[1], CHECK_ADDR, back, 4, 1);
+    iic_submit(&x[0]);
+    iic_submit(&x[1]);
+    wrote = iic_wait(&x[0]);
+    read = iic_wait(&x[1]);
+
+    printf("bench=check_engine_poll write=%d read=%d match=%d\n", wrote, read,
+           wrote == IIC_OK && read == IIC_OK && memcmp(data, back, 4) == 0);
+}
+
+//=====================================================================
+// Method to check iic_prescale() against prescale values worked out by
+// hand (see p4 of the IIC manual) and that the SCL it gives never
+// exceeds the requested frequency
+//=====================================================================
+void check_prescale(void)
+{
+    static const struct {
+        long core_hz;
+        long pre[3];                    // At 100kHz, 400kHz and 1MHz
+    } table[] = {
+        {  8000000L, { 15,  3, 1 } },
+        { 12500000L, { 24,  6, 2 } },
+        { 16000000L, { 31,  7, 3 } },
+        { 20000000L, { 39,  9, 3 } },
+        { 25000000L, { 49, 12, 4 } },
+        { 33000000L, { 65, 16, 6 } },
+    };
+    static const long speed[3] = { IIC_SPEED_STANDARD, IIC_SPEED_FAST, IIC_SPEED_FAST_PLUS };
+    int i, j, bad = 0;
+    long pre;
+
+    for(i = 0; i < sizeof(table) / sizeof(table[0]); i++)
+        for(j = 0; j < 3; j++)
+        {
+            pre = iic_prescale(table[i].core_hz, speed[j]);
+            if(pre != table[i].pre[j] || iic_effective_hz(table[i].core_hz, pre) > speed[j])
+            {
+                printf("prescale core_hz=%ld scl_hz=%ld pre=%ld expected=%ld\n", table[i].core_hz, speed[j], pre, table[i].pre[j]);
+                bad++;
+            }
+        }
+
+    printf("bench=check_prescale cases=%d bad=%d match=%d\n", i * 3, bad, bad == 0);
+}
+
+//=====================================================================
+// Method to check the CRC protected pages and the verified write
+// A CRC page must read back, and fail with IIC_ERR_CRC once a byte of
+// it is changed by a raw write. In the simulation the EEPROM stores a
+// byte of the verified write wrong, which must be caught and rewritten.
+//=====================================================================
+void check_crc(void)
+{
+    unsigned char data[CRC_PAGE_DATA], back[CRC_PAGE_DATA], byte;
+    int i, round_trip, corrupt, verified, retried = -1;     // -1: no fault to retry on the board
+
+    for(i = 0; i < CRC_PAGE_DATA; i++)
+        data[i] = i * 7 + 3;
+
+    round_trip = page_write_crc(CHECK_ADDR, data);
+    if(round_trip == IIC_OK)
+        round_trip = page_read_crc(CHECK_ADDR, back);
+    if(round_trip == IIC_OK && memcmp(data, back, CRC_PAGE_DATA))
+        round_trip = IIC_ERR_CRC;
+
+    corrupt = eeprom_read(CHECK_ADDR + 5, &byte, 1);
+    byte ^= 0x10;
+    if(corrupt == IIC_OK)
+        corrupt = eeprom_write(CHECK_ADDR + 5, &byte, 1);
+    if(corrupt == IIC_OK)
+        corrupt = page_read_crc(CHECK_ADDR, back);
+
+#ifdef IIC_SIM
+    sim_corrupt_write = 9;                  // A byte of the first write is stored wrong
+#endif
+    verified = eeprom_write_verified(CHECK_ADDR, data, 32);
+#ifdef IIC_SIM
+    retried = sim_corrupt_write == 0;
+#endif
+    if(verified == IIC_OK)
+        verified = eeprom_read(CHECK_ADDR, back, 32);
+    if(verified == IIC_OK && memcmp(data, back, 32))
+        verified = IIC_ERR_CRC;
+
+    printf("bench=check_crc round_trip=%d corrupt=%d verified=%d retried=%d match=%d\n", round_trip, corrupt,
+           verified, retried, round_trip == IIC_OK && corrupt == IIC_ERR_CRC && verified == IIC_OK && retried);
+}
+
+//=====================================================================
+// Method to check the record store survives a remount
+// Rounds of records for every key are appended, enough for a checkpoint
+// and pages after it, then the RAM index is dropped and log_mount()
+// rebuilds it. The newest record of each key is looked up by key and
+// the first round by the sequence numbers log_find() gave for them.
+//=====================================================================
+void check_log(void)
+{
+    unsigned long seqs[LOG_KEYS];
+    unsigned char data[CHECK_LOG_LEN], back[CHECK_LOG_LEN];
+    int key, round, j, found, bad = 0, status;
+
+    status = log_format();
+    for(round = 0; round < CHECK_LOG_ROUNDS && status == IIC_OK; round++)
+        for(key = 0; key < LOG_KEYS && status == IIC_OK; key++)
+        {
+            for(j = 0; j < CHECK_LOG_LEN; j++)
+                data[j] = key * 16 + round + j;
+            status = log_append(key, data, CHECK_LOG_LEN);
+            if(status == IIC_OK && round == 0)
+                log_find(key, back, CHECK_LOG_LEN, &seqs[key]);
+        }
+    if(status == IIC_OK)
+        status = log_sync();
+
+    for(key = 0; key < LOG_KEYS; key++)
+        log_index[key].page = LOG_NONE;
+    if(status == IIC_OK)
+        status = log_mount();
+
+    for(key = 0; key < LOG_KEYS && status == IIC_OK; key++)
+    {
+        if(log_find(key, back, CHECK_LOG_LEN, 0) != CHECK_LOG_LEN)
+            bad++;
+        else
+            for(j = 0; j < CHECK_LOG_LEN; j++)
+                if(back[j] != (unsigned char)(key * 16 + CHECK_LOG_ROUNDS - 1 + j))
+                {
+                    bad++;
+                    break;
+                }
+
+        if(log_find_seq(seqs[key], &found, back, CHECK_LOG_LEN) != CHECK_LOG_LEN || found != key)
+            bad++;
+        else
+            for(j = 0; j < CHECK_LOG_LEN; j++)
+                if(back[j] != (unsigned char)(key * 16 + j))
+                {
+                    bad++;
+                    break;
+                }
+    }
+
+    printf("bench=check_log status=%d records=%d bad=%d match=%d\n", status, CHECK_LOG_ROUNDS * LOG_KEYS, bad,
+           status == IIC_OK && bad == 0);
+}
+
+//=====================================================================
+// Method to run the driver checks
+// Each prints a bench=check_... line, match=1 when it passed
+//=====================================================================
+void check_run(void)
+{
+    check_engine_nack();
+    check_engine_poll();
+    check_prescale();
+    check_crc();
+    check_log();
+}
+
+//=====================================================================
+// Start of a throughput suite measurement, see suite_end()
+//=====================================================================
+unsigned long suite_t0;
+unsigned long suite_seed;
+#ifdef IIC_STATS
+struct iic_stats suite_s0;
+#endif
+#ifdef HOST_IDLE_NS
+unsigned long long suite_idle0;
+#endif
+
+void suite_begin(void)
+{
+#ifdef IIC_STATS
+    suite_s0 = iic_stats;
+#endif
+#ifdef HOST_IDLE_NS
+    suite_idle0 = HOST_IDLE_NS(iic_slave_bus(EEPROM_ADDR_LOWER));
+#endif
+    suite_t0 = ticks();
+}
+
+//=====================================================================
+// Method to report one workload as a line of key=value pairs
+// bytes is the payload the workload handled, bus_bytes the part of it
+// that went over the bus (less when some is served from RAM). With
+// IIC_STATS the line also has the SCL efficiency, bus payload bits
+// against all SCL cycles the workload put on the bus (9 per byte
+// including acknowledge polls, 1 per START and STOP), and the status
+// register polls the CPU spent waiting.
+//=====================================================================
+void suite_end_bus(char *name, long bytes, long bus_bytes, int status)
+{
+    unsigned long elapsed = ticks() - suite_t0;
+#ifdef IIC_STATS
+    unsigned long clocks, spins, pct;
+
+    clocks = 9 * (iic_stats.bytes_out - suite_s0.bytes_out + iic_stats.bytes_in - suite_s0.bytes_in) +
+             iic_stats.starts - suite_s0.starts + iic_stats.stops - suite_s0.stops;
+    spins = iic_stats.ready_spins - suite_s0.ready_spins + iic_stats.ack_spins - suite_s0.ack_spins +
+            iic_stats.irq_spins - suite_s0.irq_spins;
+#endif
+
+    printf("bench=%s status=%d bytes=%ld ticks=%lu bytes_per_s=%lu", name, status, bytes, elapsed, per_sec(bytes, elapsed));
+#ifdef HOST_IDLE_NS
+    printf(" eeprom_bus_idle_us=%lu", (unsigned long)((HOST_IDLE_NS(iic_slave_bus(EEPROM_ADDR_LOWER)) - suite_idle0) / 1000));
+#endif
+#ifdef IIC_STATS
+    pct = clocks ? 8000UL * bus_bytes / clocks : 0; // Tenths of a percent
+    printf(" scl_clocks=%lu scl_efficiency_pct=%lu.%lu spins=%lu", clocks, pct / 10, pct % 10, spins);
+#ifdef POLL_NS
+    printf(" spin_us=%lu", spins * POLL_NS / 1000);
+#endif
+#endif
+    printf("\n");
+}
+
+//===================================================
+// Method to report a workload whose payload all went over the bus
+//===================================================
+void suite_end(char *name, long bytes, int status)
+{
+    suite_end_bus(name, bytes, bytes, status);
+}
+
+//===================================================
+// Method to get the next suite pseudo random number
+// Same sequence every run, so runs can be compared
+//===================================================
+unsigned int suite_rand(void)
+{
+    suite_seed = suite_seed * 1103515245UL + 12345;
+    return (suite_seed >> 16) & 0x7FFF;
+}
+
+//===================================================
+// Method to fill a buffer with suite data
+//===================================================
+void suite_fill(unsigned char *buf, int len)
+{
+    int i;
+
+    for(i = 0; i < len; i++)
+        buf[i] = suite_rand();
+}
+
+//===================================================
+// Method to pick a random EEPROM address that leaves
+// room for len bytes
+//===================================================
+int suite_addr(int len)
+{
+    return (((long)suite_rand() << 2) ^ suite_rand()) % (EEPROM_SIZE - len + 1);
+}
+
+//=====================================================================================
+// Method to run the throughput suite
+// Fixed workloads over the EEPROM, ADC and DAC paths, one key=value line each, for
+// comparing builds. The sequential runs and the straddling transfers check what they
+// read back, a mismatch is reported as IIC_ERR_CRC. Overwrites the whole EEPROM.
+//=====================================================================================
+void suite_run(void)
+{
+    static unsigned char buf[SUITE_CHUNK], check[SUITE_CHUNK];
+    static struct iic_xfer batch[SUITE_BATCH];
+    unsigned char frame[ADC_FRAME];
+    static struct log_entry mounted[LOG_KEYS];
+    unsigned long crc, check_crc, cycles[2], read[2], bus_read;
+    long addr, n;
+    int i, status, len;
+
+    printf("suite=iic buses=%d eeprom_scl_hz=%ld adc_scl_hz=%ld ticks_per_s=%ld stats=%d\n",
+           IIC_BUSES, iic_slave_speed(EEPROM_ADDR_LOWER), iic_slave_speed(ADCDAC_ADDR), (long)TICKS_PER_SEC,
+#ifdef IIC_STATS
+           1);
+#else
+           0);
+#endif
+
+    // Sequential 128K, the same data written then read back
+    suite_seed = 1;
+    status = IIC_OK;
+    suite_begin();
+    for(addr = 0; addr < EEPROM_SIZE && status == IIC_OK; addr += SUITE_CHUNK)
+    {
+        suite_fill(buf, SUITE_CHUNK);
+        status = eeprom_write(addr, buf, SUITE_CHUNK);
+    }
+    suite_end("eeprom_seq_write", addr, status);
+
+    suite_seed = 1;
+    status = IIC_OK;
+    suite_begin();
+    for(addr = 0; addr < EEPROM_SIZE && status == IIC_OK; addr += SUITE_CHUNK)
+    {
+        status = eeprom_read(addr, check, SUITE_CHUNK);
+        suite_fill(buf, SUITE_CHUNK);
+        if(status == IIC_OK && memcmp(buf, check, SUITE_CHUNK) != 0)
+            status = IIC_ERR_CRC;
+    }
+    suite_end("eeprom_seq_read", addr, status);
+
+    // Back to back 16 byte records, each starts where the last one ended so all but the
+    // first is a current-address read (see eeprom_ptr)
+    suite_seed = 1;
+    status = IIC_OK;
+    suite_begin();
+    for(n = 0; n < SUITE_RAND_READS && status == IIC_OK; n++)
+    {
+        status = eeprom_read(n * 16, check, 16);
+        suite_fill(buf, 16);
+        if(status == IIC_OK && memcmp(buf, check, 16) != 0)
+            status = IIC_ERR_CRC;
+    }
+    suite_end("eeprom_record_read_16", n * 16, status);
+
+    // Random 1 and 16 byte accesses
+    for(len = 1; len <= 16; len += 15)
+    {
+        status = IIC_OK;
+        suite_begin();
+        for(n = 0; n < SUITE_RAND_READS && status == IIC_OK; n++)
+            status = eeprom_read(suite_addr(len), check, len);
+        suite_end(len == 1 ? "eeprom_rand_read_1" : "eeprom_rand_read_16", n * len, status);
+
+        status = IIC_OK;
+        suite_begin();
+        for(n = 0; n < SUITE_RAND_WRITES && status == IIC_OK; n++)
+        {
+            suite_fill(buf, len);
+            status = eeprom_write(suite_addr(len), buf, len);
+        }
+        suite_end(len == 1 ? "eeprom_rand_write_1" : "eeprom_rand_write_16", n * len, status);
+    }
+
+    // 256 bytes across 0x0FFFF / 0x10000, which takes a block select in the middle
+    status = IIC_OK;
+    suite_begin();
+    for(n = 0; n < SUITE_STRADDLE && status == IIC_OK; n++)
+    {
+        suite_fill(buf, 256);
+        status = eeprom_write(0x10000 - 128, buf, 256);
+        if(status == IIC_OK)
+            status = eeprom_read(0x10000 - 128, check, 256);
+        if(status == IIC_OK && memcmp(buf, check, 256) != 0)
+            status = IIC_ERR_CRC;
+    }
+    suite_end("eeprom_straddle_write_read", n * 512, status);
+
+    // Random 16 byte reads through the engine, each waited for, then the same reads
+    // batched so they run back to back chained by repeated starts
+    for(i = 0; i < 2; i++)
+    {
+        suite_seed = 7;
+        status = IIC_OK;
+        suite_begin();
+        for(n = 0; n < SUITE_BATCH; n++)
+        {
+            xfer_eeprom(&batch[n], suite_addr(16), check + 16 * n, 16, 1);
+            if(i)
+                iic_batch_add(&batch[n]);
+            else if(status == IIC_OK)
+            {
+                iic_submit(&batch[n]);
+                status = iic_wait(&batch[n]);
+            }
+        }
+        if(i)
+        {
+            iic_batch_run();
+            for(n = 0; n < SUITE_BATCH; n++)
+                if(iic_wait(&batch[n]) != IIC_OK && status == IIC_OK)
+                    status = batch[n].status;
+        }
+        suite_end(i ? "engine_read_16_batched" : "engine_read_16", SUITE_BATCH * 16, status);
+    }
+
+    // Configuration records read and written at random, straight to the EEPROM then
+    // through the write-back cache, which is flushed at the end
+    for(i = 0; i < 2; i++)
+    {
+        suite_seed = 11;
+        status = IIC_OK;
+        cache_init();
+        bus_read = eeprom_bytes_read;
+        suite_begin();
+        for(n = 0; n < SUITE_CONFIG_OPS && status == IIC_OK; n++)
+        {
+            addr = SUITE_CONFIG + (long)(suite_rand() % SUITE_CONFIG_RECORDS) * SUITE_CONFIG_LEN;
+            if(suite_rand() & 3)
+                status = i ? cache_read(addr, check, SUITE_CONFIG_LEN) : eeprom_read(addr, check, SUITE_CONFIG_LEN);
+            else
+            {
+                suite_fill(buf, SUITE_CONFIG_LEN);
+                status = i ? cache_write(addr, buf, SUITE_CONFIG_LEN) : eeprom_write(addr, buf, SUITE_CONFIG_LEN);
+            }
+        }
+        if(i && status == IIC_OK)
+            status = cache_flush();
+        // The cached run only puts its page fills and write backs on the bus
+        suite_end_bus(i ? "config_cached" : "config_direct", (long)SUITE_CONFIG_OPS * SUITE_CONFIG_LEN,
+                      i ? (long)(eeprom_bytes_read - bus_read) + (long)cache_flushes * EEPROM_PAGE_SIZE
+                        : (long)SUITE_CONFIG_OPS * SUITE_CONFIG_LEN, status);
+    }
+    cache_stats();
+
+    // Overlapping unaligned updates written one at a time, then gathered by eeprom_update()
+    // and written by eeprom_commit(). Both must leave the same data.
+    for(i = 0; i < 2; i++)
+    {
+        suite_seed = 13;
+        status = IIC_OK;
+        cycles[i] = eeprom_write_cycles;
+        suite_begin();
+        for(n = 0; n < SUITE_UPDATES && status == IIC_OK; n++)
+        {
+            addr = SUITE_UPDATE + suite_rand() % (SUITE_UPDATE_AREA - 10 + 1);
+            suite_fill(buf, 10);
+            status = i ? eeprom_update(addr, buf, 10) : eeprom_write(addr, buf, 10);
+        }
+        if(i && status == IIC_OK)
+            status = eeprom_commit();
+        cycles[i] = eeprom_write_cycles - cycles[i];
+        if(status == IIC_OK)
+            status = eeprom_read(SUITE_UPDATE, i ? buf : check, SUITE_UPDATE_AREA);
+        if(i && status == IIC_OK && memcmp(buf, check, SUITE_UPDATE_AREA))
+            status = IIC_ERR_CRC;
+        suite_end(i ? "eeprom_update_10" : "eeprom_write_10", SUITE_UPDATES * 10, status);
+    }
+    printf("bench=update_write_cycles eeprom_write=%lu eeprom_update=%lu\n", cycles[0], cycles[1]);
+
+    // An overlapping move across the block boundary, then the data checked against the
+    // CRC-32 of where it started
+    crc = 0;
+    status = eeprom_read_stream(SUITE_MOVE_SRC, SUITE_MOVE, buf, SUITE_CHUNK, crc32_chunk, &crc);
+    suite_begin();
+    if(status == IIC_OK)
+        status = eeprom_move(SUITE_MOVE_SRC + 0x1000, SUITE_MOVE_SRC, SUITE_MOVE);
+    suite_end("eeprom_move", SUITE_MOVE, status);
+
+    check_crc = 0;
+    suite_begin();
+    if(status == IIC_OK)
+        status = eeprom_read_stream(SUITE_MOVE_SRC + 0x1000, SUITE_MOVE, buf, SUITE_CHUNK, crc32_chunk, &check_crc);
+    if(status == IIC_OK && check_crc != crc)
+        status = IIC_ERR_CRC;
+    suite_end("eeprom_move_verify", SUITE_MOVE, status);
+
+    // Sustained ADC sampling through the interrupt driven engine
+    n = 0;
+    suite_begin();
+    adc_start();
+    while(n < SUITE_ADC_FRAMES && adc_running)
+    {
+        if(ring_get(&adc_ring, frame, ADC_FRAME))
+            n++;
+        else
+            CPU_IDLE();
+    }
+    adc_stop();
+    suite_end("adc_stream", adc_samples, adc_errors ? IIC_ERR_NACK : IIC_OK);
+
+    // EEPROM page writes with the ADC sampled at the same time. On one bus the sampling
+    // is paused for each write (see slog_eeprom_write()), on separate buses it carries on.
+    suite_seed = 1;
+    status = IIC_OK;
+    suite_begin();
+    adc_start();
+    for(addr = 0; addr < SUITE_PARALLEL && status == IIC_OK && adc_running; addr += EEPROM_PAGE_SIZE)
+    {
+        suite_fill(buf, EEPROM_PAGE_SIZE);
+        status = slog_eeprom_write(addr, buf, EEPROM_PAGE_SIZE);
+        while(ring_get(&adc_ring, frame, ADC_FRAME))
+            ;
+    }
+    adc_stop();
+    if(status == IIC_OK && (adc_errors || adc_ring.overflows))
+        status = IIC_ERR_NACK;
+    suite_end("eeprom_write_adc", addr + adc_samples, status);
+
+    // DAC streaming, a 1kHz sine
+    wave_load(WAVE_SINE, 0);
+    suite_begin();
+    n = wave_run(wave_step(1000, iic_slave_speed(ADCDAC_ADDR) / 9), SUITE_DAC_SAMPLES);
+    suite_end("dac_stream", n, IIC_OK);
+
+    // Fill the record store, then mount it from its checkpoint and again with the
+    // checkpoint made invalid so the ring is scanned. Both must build the same index.
+    status = log_format();
+    suite_seed = 17;
+    suite_begin();
+    for(n = 0; log_used < LOG_PAGES - 2 && status == IIC_OK; n++)
+    {
+        suite_fill(buf, SUITE_LOG_LEN);
+        status = log_append(n % LOG_KEYS, buf, SUITE_LOG_LEN);
+    }
+    if(status == IIC_OK)
+        status = log_sync();
+    suite_end("log_fill", n * SUITE_LOG_LEN, status);
+
+    for(i = 0; i < 2; i++)
+    {
+        if(i)
+        {
+            memcpy(mounted, log_index, sizeof(log_index));
+            buf[0] = 0;
+            if(status == IIC_OK)
+                status = eeprom_write(LOG_CHECKPOINT, buf, 1);
+            if(status == IIC_OK)
+                status = eeprom_write(LOG_CHECKPOINT + EEPROM_PAGE_SIZE, buf, 1);
+        }
+        read[i] = eeprom_bytes_read;
+        suite_begin();
+        if(status == IIC_OK)
+            status = log_mount();
+        read[i] = eeprom_bytes_read - read[i];
+        if(i && status == IIC_OK && memcmp(mounted, log_index, sizeof(log_index)))
+            status = IIC_ERR_CRC;
+        suite_end(i ? "log_mount_scan" : "log_mount_checkpoint", read[i], status);
+    }
+    printf("bench=log_mount_bytes_read checkpoint=%lu scan=%lu\n", read[0], read[1]);
+}
+
+//=======================================================
+// Method to let the user choose a benchmark
+//========================================================
+void Bench(void)
+{
+    int mode = 0;
+
+    printf("\nPlease choose a benchmark.\n1: CRC\n2: Sensor conversion\n3: Filters\n4: Sensor log\n5: Hex codec\n6: Throughput suite (overwrites the EEPROM)\n7: Driver checks (overwrites the EEPROM)\n");
+    scanf("%d", &mode);
+
+    if(mode == 1)
+        crc_bench();
+    else if(mode == 2)
+        sensor_bench();
+    else if(mode == 3)
+        filter_bench();
+    else if(mode == 4)
+        slog_bench();
+    else if(mode == 5)
+        hex_bench();
+    else if(mode == 6)
+        suite_run();
+    else if(mode == 7)
+        check_run();
+    else
+        printf("\nYou have entered invalid input.\n");
+}
+
+//=====================================================================
+// Method to print the bus counters and latency histogram
+// Lines of key=value pairs, then r clears the counters
+//=====================================================================
+void Stats(void)
+{
+#ifdef IIC_STATS
+    int b;
+#endif
+
+    cache_stats();
+    printf("stats=eeprom write_cycles=%lu\n", eeprom_write_cycles);
+#ifdef IIC_STATS
+
+    printf("stats=iic ready_spins=%lu ack_spins=%lu irq_spins=%lu starts=%lu stops=%lu transactions=%lu nacks=%lu bytes_out=%lu bytes_in=%lu\n",
+           iic_stats.ready_spins, iic_stats.ack_spins, iic_stats.irq_spins, iic_stats.starts, iic_stats.stops,
+           iic_stats.transactions, iic_stats.nacks, iic_stats.bytes_out, iic_stats.bytes_in);
+    printf("stats=latency unit=%s mean=%lu max=%lu\n", STAT_UNIT,
+           iic_stats.transactions ? iic_stats.latency_sum / iic_stats.transactions : 0, iic_stats.latency_max);
+    for(b = 0; b < STAT_BUCKETS; b++)
+        if(iic_stats.hist[b])
+            printf("stats=hist from=%lu to=%lu count=%lu\n", b ? 1UL << (b - 1) : 0UL,
+                   b < STAT_BUCKETS - 1 ? (1UL << b) - 1 : iic_stats.latency_max, iic_stats.hist[b]);
+
+    printf("\nPress r to clear the counters, any other key to go back.\n");
+    if(_getch() == 'r')
+    {
+        memset(&iic_stats, 0, sizeof(iic_stats));
+        for(b = 0; b < IIC_BUSES; b++)
+            iic_buses[b].stat_open = 0;
+    }
+#else
+    printf("\nBus statistics are not built in, build with -DIIC_STATS.\n");
+#endif
+}
+
 //=================================
 // main method
 //=================================
 int main(void)
 {
-    int input = 0;
+    int input = 0, b;
     Echo = 0;
 
-    init_iic();
-    en_iic();
+    for(b = 0; b < IIC_BUSES; b++)
+    {
+        init_iic(&iic_buses[b]);
+        en_iic(&iic_buses[b]);
+    }
+    timer_init();
+    uart_init();
+    iic_engine_init();
+    cache_init();
+    update_init();
 
     printf("\n\n\nThis function will allow you to write to an IIC device\n\n");
 
     while(1)
     {
         input = 0;
-        printf("\nPlease select a function:\n1: EEPROM\n2: ADC/DAC\n");
+        printf("\nPlease select a function:\n1: EEPROM\n2: ADC/DAC\n3: Bus speed\n4: Benchmarks\n5: Host link\n6: Bus statistics\n");
         Echo = 1;
         input = _getch() - (char)('0'); //scanf crashes on second loop
         Echo = 0;
@@ -925,9 +5578,26 @@ int main(void)
         {
             ADCDAC();
         }
+        else if(input == 3)
+        {
+            BusSpeed();
+        }
+        else if(input == 4)
+        {
+            Bench();
+        }
+        else if(input == 5)
+        {
+            printf("\nHost link started, run iic_host on the PC.\n");
+            HostLink();
+        }
+        else if(input == 6)
+        {
+            Stats();
+        }
         else
         {
-            printf("\nYou have entered invalid input. Please enter only one number, either 1 or 2.\n");
+            printf("\nYou have entered invalid input. Please enter a number from 1 to 6.\n");
         }
     }
 
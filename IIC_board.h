@@ -0,0 +1,42 @@
+//=====================================================================================
+// Register access for the 68K board: the OpenCores I2C core, 6850 ACIA and Timer 1 are
+// memory mapped, so each register is a volatile pointer dereference.
+//
+// IIC.c reaches the hardware only through the names defined here. Another backend
+// (IIC_sim.h, or a header named by -DIIC_BACKEND) defines the same names, and if it
+// isn't running on the board also defines IIC_HOSTED and supplies HOST_TICKS() and
+// InstallExceptionHandler(), which then replace Timer 1 and the RAM vector table.
+//=====================================================================================
+#ifndef IIC_BOARD_H
+#define IIC_BOARD_H
+
+// OpenCores I2C cores, one register block per bus. The register macros take the
+// struct iic_bus and use its base, so the same code drives either core.
+#define IIC0_BASE   0x00408000                  // Core wired to the EEPROM and ADC/DAC header
+#define IIC1_BASE   0x00408020                  // Second core of the two-bus FPGA build, IIC_BUSES=2
+#define IIC_REG(b, off)  (*(volatile unsigned char *)((b)->base + (off)))
+
+#define PRERlo(b)   IIC_REG(b, 0)               // Clock prescale register low byte
+#define PRERhi(b)   IIC_REG(b, 2)               // Clock prescale register high byte
+#define CTR(b)      IIC_REG(b, 4)               // Control register
+#define TXR(b)      IIC_REG(b, 6)               // Transmit register
+#define RXR(b)      IIC_REG(b, 6)               // Receive register
+#define CR(b)       IIC_REG(b, 8)               // Command register
+#define SR(b)       IIC_REG(b, 8)               // Status register
+
+#define RS232_Control     *(volatile unsigned char *)(0x00400040)
+#define RS232_Status      *(volatile unsigned char *)(0x00400040)
+#define RS232_TxData      *(volatile unsigned char *)(0x00400042)
+#define RS232_RxData      *(volatile unsigned char *)(0x00400042)
+
+#define Timer1Data        *(volatile unsigned char *)(0x00400030)
+#define Timer1Control     *(volatile unsigned char *)(0x00400032)
+#define Timer1Status      *(volatile unsigned char *)(0x00400032)
+#define TIMER_VECTOR      27        // Timers 1-4 are on IRQ3, level 3 autovector
+#define TIMER1_RELOAD     0x19      // Timer 1 delay for one tick, set for the timer clock of the hardware build
+#define TICKS_PER_SEC     1000      // Rate Ticks is incremented at by Timer_ISR()
+
+#define StartOfExceptionVectorTable 0x08030000
+#define CPU_IDLE()                  ((void)0)  // Nothing to do while waiting for an interrupt
+
+#endif
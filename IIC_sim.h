@@ -0,0 +1,650 @@
+//=====================================================================================
+// Host simulation of the I2C hardware used by IIC.c
+//
+// Build on a Linux host with:   gcc -DIIC_SIM -o iic_sim IIC.c -lm
+//
+// The register macros in IIC.c expand to the accessor functions below instead of the
+// 68K memory mapped addresses. Writes to a register are stored in a cell and acted on
+// lazily by the next register access (sim_commit()), so the driver code runs unchanged.
+//
+// Simulated devices:
+//   - OpenCores I2C controller (TIP, IF, RxACK, BUSY) with transfer times derived
+//     from the prescale registers and the core clock
+//   - 24LC1025 EEPROM with block select, 128 byte page buffer and a 5ms internal
+//     write cycle during which the control byte is NACKed
+//   - PCF8591 ADC/DAC with channel auto-increment, inputs are slow ramps
+//   - 6850 ACIA mapped onto stdin/stdout, sending or receiving a character takes
+//     SIM_ACIA_CHAR_NS and the receive and transmit interrupts are raised on
+//     SIM_ACIA_VECTOR. printf() goes out through _putch() like on the board, scanf()
+//     reads stdin directly, so it doesn't see characters the receive interrupt took.
+//
+// When IEN is set in CTR the core raises a virtual interrupt: the handler installed
+// with InstallExceptionHandler() is called as soon as IF is set. CPU_IDLE() skips
+// simulated time ahead to the next interrupt.
+//
+// With IIC_BUSES=2 there are two controllers, each with its own registers, transfer
+// timing and interrupt vector. The EEPROM is on bus 0 and the ADC/DAC on the last bus,
+// matching iic_devices in IIC.c, so a transfer on one bus runs while the CPU polls or
+// interrupts arrive for the other.
+//
+// Environment variables:
+//   IIC_SIM_REPORT=1         At exit print register accesses, core clock cycles, bus
+//                            busy time and device counters to stderr as key=value pairs
+//   IIC_SIM_DAC_TRACE=file   Write each DAC update to file as "ns value" lines
+//=====================================================================================
+#include <stdlib.h>
+#include <stdarg.h>
+#include <poll.h>
+#include <time.h>
+#include <math.h>
+
+#define SIM_CORE_HZ         25000000UL  // wb_clk_i of the I2C core
+#define SIM_ACCESS_NS       200         // Cost of one register access by the 68K
+#define SIM_WRITE_CYCLE_NS  5000000UL   // 24LC1025 internal write cycle (Twc = 5ms)
+#define SIM_IIC_VECTOR      30          // Exception vector of the I2C core, IIC_IRQ_VECTOR in IIC.c
+#define SIM_IIC1_VECTOR     29          // Exception vector of the second core, IIC1_IRQ_VECTOR in IIC.c
+#define SIM_BUSES           IIC_BUSES   // Simulated I2C controllers
+#define SIM_EEPROM_BUS      0           // Bus the 24LC1025 is on
+#define SIM_ADC_BUS         (SIM_BUSES - 1) // Bus the PCF8591 is on
+#define SIM_ACIA_VECTOR     26          // Exception vector of the ACIA, ACIA_VECTOR in IIC.c
+#define SIM_ACIA_CHAR_NS    86806ULL    // 10 bits at 115200 baud
+#define SIM_ACIA_POLL       64          // Register accesses between checks of stdin for the receive interrupt
+
+#define TICKS_PER_SEC       1000000     // ticks() counts microseconds in the simulation
+#define POLL_NS             SIM_ACCESS_NS   // A status register poll is one register access
+
+// Status register bits
+#define SIM_SR_RXACK   0x80
+#define SIM_SR_BUSY    0x40
+#define SIM_SR_TIP     0x02
+#define SIM_SR_IF      0x01
+
+// Command register bits
+#define SIM_CR_STA     0x80
+#define SIM_CR_STO     0x40
+#define SIM_CR_RD      0x20
+#define SIM_CR_WR      0x10
+#define SIM_CR_ACK     0x08
+#define SIM_CR_IACK    0x01
+
+struct sim_eeprom {
+    unsigned char mem[0x20000];
+    unsigned char page[0x80];           // Page buffer loaded by a write sequence
+    unsigned char page_used[0x80];      // Which bytes of the page buffer were written
+    int ptr;                            // Internal address counter, includes block bit
+    int phase;                          // 0 = address high, 1 = address low, 2 = data
+    int dirty;                          // Page buffer holds data to be committed on STOP
+    unsigned long long busy_until;      // End of the internal write cycle
+    unsigned long write_cycles;
+};
+
+struct sim_iic {
+    int id;                             // Bus number, the argument of the register accessors
+    int vector;                         // Exception vector of the core's interrupt
+    unsigned char prer_lo, prer_hi, ctr, txr, rxr, sr;
+    unsigned char cr_cell;              // Last value written to CR, consumed by sim_commit()
+    unsigned char txr_cell;
+    int addressing;                     // Next written byte is a slave address
+    int selected;                       // Slave address (7 bit) currently addressed, -1 if none
+    int reading;                        // Selected slave is in read mode
+    unsigned long long tip_until;       // Transfer in progress until this time
+    int if_pending;                     // IF gets set when the transfer completes
+    unsigned long long busy_ns;         // Time SCL was clocking on this bus, see sim_busy_ns
+};
+
+struct sim_adc {
+    int control;                        // Control byte, -1 until one is written
+    int channel;                        // Channel the next read returns
+    int dac;                            // Last value written to the DAC
+    unsigned long reads;                // Conversions read
+    unsigned long dac_writes;
+    FILE *trace;                        // DAC output trace, see sim_dac_write()
+    int trace_checked;                  // IIC_SIM_DAC_TRACE has been looked at
+};
+
+struct sim_acia {
+    unsigned char status, tx_cell, rx;
+    unsigned char control;              // Last value written to the control register
+    int tx_pending;
+    int started;
+    int rx_ready;                       // stdin had a character at the last check
+    int held, eof;                      // next was read ahead from stdin, stdin has ended
+    unsigned char next;
+    int poll_count;
+    unsigned long long tx_until;        // Transmit data register full until this time
+    unsigned long long rx_until;        // Next character can't arrive before this time
+};
+
+struct sim_iic sim_iic[SIM_BUSES] = {
+    { 0, SIM_IIC_VECTOR, 0xFF, 0xFF },
+#if SIM_BUSES > 1
+    { 1, SIM_IIC1_VECTOR, 0xFF, 0xFF },
+#endif
+};
+struct sim_eeprom sim_eeprom;
+struct sim_acia sim_acia;
+struct sim_adc sim_adc = { -1 };
+unsigned long long sim_now;             // Simulated time in ns
+unsigned long sim_accesses;             // Register accesses by the CPU
+void (*sim_vectors[256])();             // Exception vector table
+int sim_in_isr;
+unsigned long sim_irqs;                 // Number of virtual interrupts taken
+unsigned long sim_nack_write;           // Fault injection: counts data bytes written, the one taking it to 0 is NACKed
+unsigned long sim_corrupt_write;        // Fault injection: counts bytes stored in the EEPROM, the one taking it to 0 is inverted
+
+// Bus activity, summed over the buses. A single bus is idle for sim_now minus sim_busy_ns
+unsigned long long sim_busy_ns;         // Time SCL was clocking a start, byte or stop
+unsigned long sim_starts, sim_stops;    // Start (including repeated start) and stop conditions
+
+//===================================================
+// Method to get the length of one SCL period of a bus in ns
+//===================================================
+unsigned long long sim_scl_ns(struct sim_iic *c)
+{
+    unsigned long pre = ((unsigned long)c->prer_hi << 8) | c->prer_lo;
+
+    return (unsigned long long)5 * (pre + 1) * 1000000000ULL / SIM_CORE_HZ;
+}
+
+//=====================================================================
+// Method to get the time in cycles of the core's clock (wb_clk_i)
+// The controller's byte and bit timings are whole numbers of these:
+// one SCL period is 5 * (prescale + 1) cycles
+//=====================================================================
+unsigned long long sim_cycles(void)
+{
+    return sim_now * (SIM_CORE_HZ / 1000000UL) / 1000ULL;
+}
+
+//=====================================================================
+// Method to print the simulation counters to stderr, see IIC_SIM_REPORT
+//=====================================================================
+void sim_report(void)
+{
+    fprintf(stderr, "sim ns=%llu cycles=%llu accesses=%lu busy_ns=%llu starts=%lu stops=%lu irqs=%lu "
+            "eeprom_write_cycles=%lu adc_reads=%lu dac_writes=%lu\n",
+            sim_now, sim_cycles(), sim_accesses, sim_busy_ns, sim_starts, sim_stops, sim_irqs,
+            sim_eeprom.write_cycles, sim_adc.reads, sim_adc.dac_writes);
+}
+
+//=====================================================================
+// Method to update the DAC output
+// Each update is traced when IIC_SIM_DAC_TRACE names a file
+//=====================================================================
+void sim_dac_write(int value)
+{
+    char *name;
+
+    if(!sim_adc.trace_checked)
+    {
+        sim_adc.trace_checked = 1;
+        if((name = getenv("IIC_SIM_DAC_TRACE")) != NULL && (sim_adc.trace = fopen(name, "w")) == NULL)
+            perror(name);
+    }
+    sim_adc.dac = value;
+    sim_adc.dac_writes++;
+    if(sim_adc.trace)
+        fprintf(sim_adc.trace, "%llu %d\n", sim_now + 9 * sim_scl_ns(&sim_iic[SIM_ADC_BUS]), value);    // Output changes after the ACK bit
+}
+
+//===================================================
+// Method to end the current EEPROM write sequence
+//===================================================
+void sim_eeprom_stop(struct sim_iic *c)
+{
+    struct sim_eeprom *e = &sim_eeprom;
+    int base, i;
+
+    if(e->dirty)
+    {
+        base = e->ptr & ~0x7F;
+        for(i = 0; i < 0x80; i++)
+            if(e->page_used[i])
+                e->mem[base + i] = e->page[i];
+        e->busy_until = c->tip_until + SIM_WRITE_CYCLE_NS;
+        e->write_cycles++;
+        e->dirty = 0;
+    }
+    e->phase = 0;
+}
+
+//===================================================
+// Method to address a slave on a bus, returns 1 on ACK
+//===================================================
+int sim_address(struct sim_iic *c, int byte)
+{
+    int slave = byte >> 1;
+
+    c->reading = byte & 1;
+    c->selected = -1;
+    if((slave & ~0x04) == 0x50 && c->id == SIM_EEPROM_BUS)
+    {
+        if(sim_now < sim_eeprom.busy_until)
+            return 0;                   // NACK while the write cycle is in progress
+        sim_eeprom.ptr = (slave & 0x04) ? (sim_eeprom.ptr | 0x10000) : (sim_eeprom.ptr & 0xFFFF);
+        sim_eeprom.phase = 0;
+        c->selected = slave;
+        return 1;
+    }
+    if(slave == 0x48 && c->id == SIM_ADC_BUS)
+    {
+        if(!c->reading)
+            sim_adc.control = -1;       // First byte written is a new control byte
+        c->selected = slave;
+        return 1;
+    }
+    return 0;
+}
+
+//===================================================
+// Method to write a data byte to the addressed slave, returns 1 on ACK
+//===================================================
+int sim_write(struct sim_iic *c, int byte)
+{
+    struct sim_eeprom *e = &sim_eeprom;
+
+    if(c->selected < 0 || c->reading)
+        return 0;
+    if(sim_nack_write && --sim_nack_write == 0)
+        return 0;
+    if(c->selected == 0x48)
+    {
+        if(sim_adc.control < 0)
+        {
+            sim_adc.control = byte;
+            sim_adc.channel = byte & 0x03;
+        }
+        else
+            sim_dac_write(byte);
+        return 1;
+    }
+    if(e->phase == 0)
+    {
+        e->ptr = (e->ptr & 0x10000) | (byte << 8) | (e->ptr & 0xFF);
+        e->phase = 1;
+    }
+    else if(e->phase == 1)
+    {
+        e->ptr = (e->ptr & 0x1FF00) | byte;
+        e->phase = 2;
+        memset(e->page_used, 0, sizeof(e->page_used));
+    }
+    else
+    {
+        // Page write: the low 7 bits wrap inside the 128 byte page
+        if(sim_corrupt_write && --sim_corrupt_write == 0)
+            byte ^= 0xFF;
+        e->page[e->ptr & 0x7F] = byte;
+        e->page_used[e->ptr & 0x7F] = 1;
+        e->ptr = (e->ptr & ~0x7F) | ((e->ptr + 1) & 0x7F);
+        e->dirty = 1;
+    }
+    return 1;
+}
+
+//===================================================
+// Method to read a data byte from the addressed slave
+//===================================================
+int sim_read(struct sim_iic *c)
+{
+    struct sim_eeprom *e = &sim_eeprom;
+    int data;
+
+    if(c->selected < 0 || !c->reading)
+        return 0xFF;
+    if(c->selected == 0x48)
+    {
+        // Each channel ramps at its own rate so they can be told apart
+        data = (int)((sim_now / 1000000ULL * (sim_adc.channel + 1) + sim_adc.channel * 64) & 0xFF);
+        if(sim_adc.control & 0x04)
+            sim_adc.channel = (sim_adc.channel + 1) & 0x03;
+        sim_adc.reads++;
+        return data;
+    }
+    data = e->mem[e->ptr];
+    e->ptr = (e->ptr & 0x10000) | ((e->ptr + 1) & 0xFFFF);  // Sequential reads roll over inside a block
+    return data;
+}
+
+//===================================================
+// Method to execute a command written to the command register
+//===================================================
+void sim_command(struct sim_iic *c, unsigned char cmd)
+{
+    int bits = 0, acked = 1;
+
+    if(cmd & SIM_CR_IACK)
+        c->sr &= ~SIM_SR_IF;
+    if(!(c->ctr & 0x80))
+        return;                         // Core disabled
+
+    if(sim_now < c->tip_until)
+        sim_now = c->tip_until;
+
+    if(cmd & SIM_CR_STA)
+    {
+        if(c->id == SIM_EEPROM_BUS)
+        {
+            sim_eeprom.dirty = 0;       // Repeated start ends a write sequence without committing it
+            sim_eeprom.phase = 0;
+        }
+        c->addressing = 1;
+        c->sr |= SIM_SR_BUSY;
+        bits++;
+    }
+    if(cmd & SIM_CR_WR)
+    {
+        if(c->addressing)
+            acked = sim_address(c, c->txr);
+        else
+            acked = sim_write(c, c->txr);
+        c->addressing = 0;
+        bits += 9;
+        if(acked)
+            c->sr &= ~SIM_SR_RXACK;
+        else
+            c->sr |= SIM_SR_RXACK;
+    }
+    else if(cmd & SIM_CR_RD)
+    {
+        c->rxr = sim_read(c);
+        bits += 9;
+    }
+    c->tip_until = sim_now + bits * sim_scl_ns(c);
+    if(cmd & SIM_CR_STO)
+    {
+        c->tip_until += sim_scl_ns(c);
+        if(c->selected >= 0 && !c->reading)
+            sim_eeprom_stop(c);
+        c->selected = -1;
+        c->sr &= ~SIM_SR_BUSY;
+    }
+    if(bits || (cmd & SIM_CR_STO))
+        c->if_pending = 1;
+    sim_busy_ns += c->tip_until - sim_now;
+    c->busy_ns += c->tip_until - sim_now;
+    if(cmd & SIM_CR_STA)
+        sim_starts++;
+    if(cmd & SIM_CR_STO)
+        sim_stops++;
+}
+
+//===================================================
+// Method to update TIP and IF of a bus for the current time
+//===================================================
+void sim_update_status(struct sim_iic *c)
+{
+    if(sim_now < c->tip_until)
+        c->sr |= SIM_SR_TIP;
+    else
+    {
+        c->sr &= ~SIM_SR_TIP;
+        if(c->if_pending)
+        {
+            c->sr |= SIM_SR_IF;
+            c->if_pending = 0;
+        }
+    }
+}
+
+void sim_commit(void);
+
+//=====================================================================
+// Method to check stdin for a character
+// With the receive interrupt on the character is read ahead, so the
+// end of stdin ends the program only once the driver is idle waiting
+// for input, not while its receive ring still holds characters
+//=====================================================================
+int sim_acia_rx_ready(void)
+{
+    struct pollfd p;
+    int c;
+
+    if(sim_now < sim_acia.rx_until)
+        return sim_acia.rx_ready = 0;   // Still receiving the previous character's bits
+    if(sim_acia.held)
+        return sim_acia.rx_ready = 1;
+    if(sim_acia.eof)
+        return sim_acia.rx_ready = 0;
+    p.fd = 0;
+    p.events = POLLIN;
+    sim_acia.rx_ready = poll(&p, 1, 0) > 0;
+    if(sim_acia.rx_ready && (sim_acia.control & 0x80))
+    {
+        if((c = getchar()) == EOF)
+            sim_acia.eof = 1, sim_acia.rx_ready = 0;
+        else
+            sim_acia.next = c, sim_acia.held = 1;
+    }
+    return sim_acia.rx_ready;
+}
+
+//===================================================
+// Method to see if the ACIA is asking for an interrupt
+//===================================================
+int sim_acia_irq(void)
+{
+    if(!sim_vectors[SIM_ACIA_VECTOR])
+        return 0;
+    if((sim_acia.control & 0x60) == 0x20 && sim_now >= sim_acia.tx_until)
+        return 1;
+    if((sim_acia.control & 0x80) && ++sim_acia.poll_count >= SIM_ACIA_POLL)
+    {
+        sim_acia.poll_count = 0;
+        return sim_acia_rx_ready();
+    }
+    return 0;
+}
+
+//=====================================================================
+// Method to raise the virtual I2C interrupt of every bus with IEN and
+// IF set, bus 0 first, then the ACIA interrupt
+// Each ISR installed with InstallExceptionHandler() runs to completion,
+// then its last register write is acted on before the next one. All of
+// them run before sim_idle() moves time on, so no bus waits on another.
+//=====================================================================
+void sim_check_irq(void)
+{
+    struct sim_iic *c;
+
+    if(sim_in_isr)
+        return;
+
+    for(c = sim_iic; c < sim_iic + SIM_BUSES; c++)
+    {
+        if((c->ctr & 0x40) && (c->sr & SIM_SR_IF) && sim_vectors[c->vector])
+        {
+            sim_in_isr = 1;
+            sim_irqs++;
+            sim_vectors[c->vector]();
+            sim_commit();
+            sim_in_isr = 0;
+        }
+    }
+    if(sim_acia_irq())
+    {
+        sim_in_isr = 1;
+        sim_vectors[SIM_ACIA_VECTOR]();
+        sim_commit();
+        sim_in_isr = 0;
+    }
+}
+
+//===================================================
+// Method to act on the last write to the command register
+//===================================================
+void sim_commit(void)
+{
+    struct sim_iic *c;
+    unsigned char cmd;
+
+    sim_now += SIM_ACCESS_NS;
+    sim_accesses++;
+    if(!sim_acia.started)
+    {
+        setvbuf(stdin, NULL, _IONBF, 0);    // Let poll() see every character not yet read
+        sim_acia.started = 1;
+        if(getenv("IIC_SIM_REPORT"))
+            atexit(sim_report);
+    }
+
+    if(sim_acia.tx_pending)
+    {
+        putchar(sim_acia.tx_cell);
+        fflush(stdout);
+        sim_acia.tx_pending = 0;
+        sim_acia.tx_until = sim_now + SIM_ACIA_CHAR_NS;
+    }
+    for(c = sim_iic; c < sim_iic + SIM_BUSES; c++)
+    {
+        c->txr = c->txr_cell;
+        if((cmd = c->cr_cell) != 0)
+        {
+            c->cr_cell = 0;
+            sim_command(c, cmd);
+        }
+        sim_update_status(c);
+    }
+    sim_check_irq();
+}
+
+//=====================================================================
+// Method for the CPU to wait for an interrupt
+// Skips simulated time to the end of the first transfer in progress
+//=====================================================================
+void sim_idle(void)
+{
+    unsigned long long until = 0;
+    struct sim_iic *c;
+
+    for(c = sim_iic; c < sim_iic + SIM_BUSES; c++)
+        if(sim_now < c->tip_until && (!until || c->tip_until < until))
+            until = c->tip_until;
+
+    if(until)
+        sim_now = until;
+    else if((sim_acia.control & 0x60) == 0x20 && sim_now < sim_acia.tx_until)
+        sim_now = sim_acia.tx_until;
+    else if(sim_acia.control & 0x80)
+    {
+        if(sim_acia.eof && (sim_acia.control & 0x60) != 0x20)
+            exit(0);                            // Waiting for input that will never come, nothing left to send
+        if(sim_now < sim_acia.rx_until)
+            sim_now = sim_acia.rx_until;
+        sim_acia.poll_count = SIM_ACIA_POLL;    // Waiting for a key, look at stdin now
+    }
+    sim_commit();
+}
+
+//=====================================================================
+// Method to read the time base in microseconds
+// Simulated bus time plus the host CPU time spent in the driver, so
+// code that never touches a register still takes time
+//=====================================================================
+unsigned long sim_ticks(void)
+{
+    return (unsigned long)(sim_now / 1000) + (unsigned long)(clock() * (1000000.0 / CLOCKS_PER_SEC));
+}
+
+//===================================================
+// Method to install an interrupt handler in the simulated vector table
+//===================================================
+void InstallExceptionHandler(void (*function_ptr)(), int level)
+{
+    sim_vectors[level] = function_ptr;
+}
+
+//===================================================
+// Register accessors used by the macros in IIC.c
+//===================================================
+unsigned char *sim_reg_prerlo(int bus) { sim_commit(); return &sim_iic[bus].prer_lo; }
+unsigned char *sim_reg_prerhi(int bus) { sim_commit(); return &sim_iic[bus].prer_hi; }
+unsigned char *sim_reg_ctr(int bus)    { sim_commit(); return &sim_iic[bus].ctr; }
+unsigned char *sim_reg_txr(int bus)    { sim_commit(); return &sim_iic[bus].txr_cell; }
+unsigned char *sim_reg_rxr(int bus)    { sim_commit(); return &sim_iic[bus].rxr; }
+unsigned char *sim_reg_cr(int bus)     { sim_commit(); return &sim_iic[bus].cr_cell; }
+
+unsigned char *sim_reg_sr(int bus)     { sim_commit(); return &sim_iic[bus].sr; }
+
+unsigned char *sim_acia_status(void)
+{
+    sim_commit();
+    sim_acia.status = sim_now >= sim_acia.tx_until ? 0x02 : 0;
+    if(sim_acia_rx_ready())
+        sim_acia.status |= 0x01;
+    return &sim_acia.status;
+}
+
+unsigned char *sim_acia_control(void)
+{
+    sim_commit();
+    return &sim_acia.control;
+}
+
+unsigned char *sim_acia_tx(void)
+{
+    sim_commit();
+    sim_acia.tx_pending = 1;
+    return &sim_acia.tx_cell;
+}
+
+unsigned char *sim_acia_rx(void)
+{
+    int c;
+
+    sim_commit();
+    fflush(stdout);
+    if(sim_acia.held)
+        c = sim_acia.next, sim_acia.held = 0;
+    else if((c = getchar()) == EOF)
+        exit(0);
+    sim_acia.rx = c;
+    sim_acia.rx_until = sim_now + SIM_ACIA_CHAR_NS;
+    return &sim_acia.rx;
+}
+
+// The register macros take the struct iic_bus, see IIC_board.h
+#define IIC0_BASE   0
+#define IIC1_BASE   0
+#define PRERlo(b)   (*sim_reg_prerlo((b)->id))
+#define PRERhi(b)   (*sim_reg_prerhi((b)->id))
+#define CTR(b)      (*sim_reg_ctr((b)->id))
+#define TXR(b)      (*sim_reg_txr((b)->id))
+#define RXR(b)      (*sim_reg_rxr((b)->id))
+#define CR(b)       (*sim_reg_cr((b)->id))
+#define SR(b)       (*sim_reg_sr((b)->id))
+
+#define CPU_IDLE()  sim_idle()
+
+// Not on the board: ticks() and the vector table come from here, see IIC_board.h
+#define IIC_HOSTED
+#define HOST_TICKS()    sim_ticks()
+#define HOST_IDLE_NS(b) (sim_now - sim_iic[(b)->id].busy_ns)    // Time the bus wasn't clocking
+
+#define RS232_Control     (*sim_acia_control())
+#define RS232_Status      (*sim_acia_status())
+#define RS232_TxData      (*sim_acia_tx())
+#define RS232_RxData      (*sim_acia_rx())
+
+//=====================================================================
+// printf() for the driver, sent through _putch() as on the board
+// Keeps it in order with the characters in the transmit ring and
+// gives console output its serial port time
+//=====================================================================
+int _putch(int c);
+
+int sim_printf(const char *format, ...)
+{
+    char buf[1024];
+    va_list ap;
+    int n, i;
+
+    va_start(ap, format);
+    n = vsnprintf(buf, sizeof(buf), format, ap);
+    va_end(ap);
+    for(i = 0; i < n && i < (int)sizeof(buf) - 1; i++)
+        _putch(buf[i]);
+    return n;
+}
+
+#define printf sim_printf
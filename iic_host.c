@@ -0,0 +1,466 @@
+//=====================================================================================
+// Host side of the binary EEPROM link, see proto.h
+//
+// Build on Linux with:   gcc -o iic_host iic_host.c
+//
+// Usage:  iic_host <port> <command> [args]
+//
+//   <port>    Serial device such as /dev/ttyUSB0 (set to 115200 8N1), or !<command> to run
+//             a program and talk to it through its stdin/stdout, e.g. "!./iic_sim" to run
+//             against the host simulation
+//
+//   read   <addr> <len> <file>     Save len bytes of the EEPROM from addr in file
+//   write  <addr> <file>           Write file to the EEPROM at addr
+//   verify <addr> <file>           Compare the EEPROM at addr with file by CRC-32
+//   erase  <addr> <len>            Fill len bytes from addr with 0xFF
+//   selftest <addr> <len>          Write, verify, read back and erase a random image
+//
+// Addresses and lengths are hex. The tool selects the "Host link" entry of the main menu
+// before the first frame.
+//=====================================================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <signal.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include "proto.h"
+
+#define IIC_OK          0
+#define IIC_ERR_CRC    -4
+#define EEPROM_SIZE     0x20000
+#define PAGE_SIZE       0x80
+#define TIMEOUT_MS      1000        // Resend unacknowledged frames after this
+#define LONG_TIMEOUT_MS 60000       // Erase and verify of the whole EEPROM
+#define RETRIES         20
+
+int fd_in = -1, fd_out = -1;
+struct proto_rx rx;
+unsigned long frames_sent = 0, frames_resent = 0;
+
+//===================================================
+// Method to update a CRC-16/CCITT one bit at a time
+//===================================================
+unsigned int crc16(unsigned int crc, unsigned char *buf, int len)
+{
+    int i;
+
+    while(len-- > 0)
+    {
+        crc ^= *buf++ << 8;
+        for(i = 0; i < 8; i++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc & 0xFFFF;
+}
+
+//===================================================
+// Method to update a CRC-32 one bit at a time
+//===================================================
+unsigned long crc32(unsigned long crc, unsigned char *buf, long len)
+{
+    int i;
+
+    crc = ~crc & 0xFFFFFFFF;
+    while(len-- > 0)
+    {
+        crc ^= *buf++;
+        for(i = 0; i < 8; i++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+    }
+    return ~crc & 0xFFFFFFFF;
+}
+
+//===================================================
+// Method to get the time in ms
+//===================================================
+long now_ms(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
+
+//===================================================
+// Method to open a serial port in raw mode at 115200 baud
+//===================================================
+int open_port(char *path)
+{
+    struct termios t;
+    int fd = open(path, O_RDWR | O_NOCTTY);
+
+    if(fd < 0 || tcgetattr(fd, &t) < 0)
+        return -1;
+    cfmakeraw(&t);
+    cfsetispeed(&t, B115200);
+    cfsetospeed(&t, B115200);
+    t.c_cflag |= CLOCAL | CREAD;
+    if(tcsetattr(fd, TCSANOW, &t) < 0)
+        return -1;
+    fd_in = fd_out = fd;
+    return 0;
+}
+
+//===================================================
+// Method to run a program with its stdin/stdout as the link
+//===================================================
+int open_program(char *cmd)
+{
+    int to[2], from[2];
+
+    if(pipe(to) < 0 || pipe(from) < 0)
+        return -1;
+    if(fork() == 0)
+    {
+        dup2(to[0], 0);
+        dup2(from[1], 1);
+        close(to[1]);
+        close(from[0]);
+        execl("/bin/sh", "sh", "-c", cmd, (char *)0);
+        _exit(127);
+    }
+    close(to[0]);
+    close(from[1]);
+    fd_out = to[1];
+    fd_in = from[0];
+    signal(SIGPIPE, SIG_IGN);
+    return 0;
+}
+
+//===================================================
+// Method to send a frame
+//===================================================
+void send_frame(int cmd, int seq, unsigned char *payload, int len)
+{
+    unsigned char out[PROTO_MAX_FRAME];
+    int n = proto_frame(out, cmd, seq, payload, len);
+
+    if(write(fd_out, out, n) != n)
+    {
+        fprintf(stderr, "iic_host: link closed\n");
+        exit(1);
+    }
+    frames_sent++;
+}
+
+//=====================================================================
+// Method to wait for a frame
+// Returns 1 with the frame in rx, 0 on timeout. Damaged frames and
+// anything between frames are skipped.
+//=====================================================================
+int recv_frame(long timeout_ms)
+{
+    long end = now_ms() + timeout_ms, left;
+    unsigned char c;
+    struct timeval tv;
+    fd_set set;
+
+    while((left = end - now_ms()) > 0)
+    {
+        FD_ZERO(&set);
+        FD_SET(fd_in, &set);
+        tv.tv_sec = left / 1000;
+        tv.tv_usec = (left % 1000) * 1000;
+        if(select(fd_in + 1, &set, 0, 0, &tv) <= 0)
+            break;
+        if(read(fd_in, &c, 1) != 1)
+        {
+            fprintf(stderr, "iic_host: link closed\n");
+            exit(1);
+        }
+        if(proto_rx_byte(&rx, c) == 1)
+            return 1;
+    }
+    return 0;
+}
+
+//=====================================================================
+// Method to send a single command and wait for its acknowledgement
+// Returns the status the target reported
+//=====================================================================
+int command(int cmd, unsigned char *payload, int len, long timeout_ms)
+{
+    int tries;
+
+    for(tries = 0; tries < RETRIES; tries++)
+    {
+        send_frame(cmd, 0, payload, len);
+        while(recv_frame(timeout_ms))
+            if(rx.buf[1] == PROTO_ACK && rx.buf[2] == 0)
+                return (signed char)rx.buf[3];
+        frames_resent++;
+    }
+    fprintf(stderr, "iic_host: no answer from the target\n");
+    exit(1);
+}
+
+//=====================================================================================
+// Method to write len bytes to the EEPROM at addr
+// Frames are split at page boundaries so each is one page write. Up to PROTO_WINDOW go
+// out ahead of their acknowledgements; a NAK or a timeout goes back to the first frame
+// not acknowledged.
+//=====================================================================================
+int link_write(long addr, unsigned char *data, long len)
+{
+    unsigned char payload[3 + PROTO_DATA];
+    long frames = 0, base = 0, next = 0, d, a, *start;
+    int n, status, idle = 0;
+
+    start = malloc((len / PAGE_SIZE + 2) * sizeof(long));
+    for(a = addr; a < addr + len; a += PAGE_SIZE - (a & (PAGE_SIZE - 1)))
+        start[frames++] = a;
+    start[frames] = addr + len;
+
+    while(base < frames)
+    {
+        while(next < frames && next < base + PROTO_WINDOW)
+        {
+            n = start[next + 1] - start[next];
+            proto_put24(payload, start[next]);
+            memcpy(payload + 3, data + (start[next] - addr), n);
+            send_frame(PROTO_WRITE, next & 0xFF, payload, 3 + n);
+            next++;
+        }
+
+        if(!recv_frame(TIMEOUT_MS))
+        {
+            if(++idle > RETRIES)
+                break;
+            frames_resent += next - base;
+            next = base;
+            continue;
+        }
+        idle = 0;
+        d = (rx.buf[2] - base) & 0xFF;
+        if(rx.buf[1] == PROTO_ACK && d < next - base)
+        {
+            status = (signed char)rx.buf[3];
+            if(status != IIC_OK)
+            {
+                free(start);
+                return status;
+            }
+            base += d + 1;
+        }
+        else if(rx.buf[1] == PROTO_NAK && d <= next - base)
+        {
+            frames_resent += next - base - d;
+            next = base += d;
+        }
+    }
+    free(start);
+    if(base < frames)
+    {
+        fprintf(stderr, "iic_host: no answer from the target\n");
+        exit(1);
+    }
+    return IIC_OK;
+}
+
+//=====================================================================================
+// Method to read len bytes of the EEPROM at addr
+// Data frames are taken in SEQ order and each acknowledged; a repeat of one already
+// taken is acknowledged again, one out of order gets a NAK for the SEQ expected.
+//=====================================================================================
+int link_read(long addr, unsigned char *data, long len)
+{
+    unsigned char payload[6];
+    long frames = (len + PROTO_DATA - 1) / PROTO_DATA, expect = 0;
+    int seq, idle = 0;
+
+    proto_put24(payload, addr);
+    proto_put24(payload + 3, len);
+    send_frame(PROTO_READ, 0, payload, 6);
+
+    while(expect < frames)
+    {
+        if(!recv_frame(TIMEOUT_MS))
+        {
+            if(++idle > RETRIES)
+            {
+                fprintf(stderr, "iic_host: no answer from the target\n");
+                exit(1);
+            }
+            if(expect == 0)
+                send_frame(PROTO_READ, 0, payload, 6);      // The request itself was lost
+            else
+                send_frame(PROTO_NAK, expect & 0xFF, 0, 0);
+            frames_resent++;
+            continue;
+        }
+        idle = 0;
+        seq = rx.buf[2];
+        if(rx.buf[1] == PROTO_ACK)
+            return (signed char)rx.buf[3];                  // The target gave up with an error
+        if(rx.buf[1] != PROTO_DATA_FRAME)
+            continue;
+
+        if(seq == (expect & 0xFF))
+        {
+            memcpy(data + expect * PROTO_DATA, rx.buf + 3, rx.len - 2);
+            send_frame(PROTO_ACK, seq, 0, 0);
+            expect++;
+        }
+        else if(((expect - 1 - seq) & 0xFF) < PROTO_WINDOW)
+            send_frame(PROTO_ACK, seq, 0, 0);
+        else
+            send_frame(PROTO_NAK, expect & 0xFF, 0, 0);
+    }
+    return IIC_OK;
+}
+
+//===================================================
+// Method to compare the EEPROM with data by CRC-32
+//===================================================
+int link_verify(long addr, unsigned char *data, long len)
+{
+    unsigned char payload[10];
+
+    proto_put24(payload, addr);
+    proto_put24(payload + 3, len);
+    proto_put32(payload + 6, crc32(0, data, len));
+    return command(PROTO_VERIFY, payload, 10, LONG_TIMEOUT_MS);
+}
+
+//===================================================
+// Method to fill a range of the EEPROM with 0xFF
+//===================================================
+int link_erase(long addr, long len)
+{
+    unsigned char payload[6];
+
+    proto_put24(payload, addr);
+    proto_put24(payload + 3, len);
+    return command(PROTO_ERASE, payload, 6, LONG_TIMEOUT_MS);
+}
+
+//===================================================
+// Method to load a file into memory
+//===================================================
+unsigned char *load(char *path, long *len)
+{
+    unsigned char *data = malloc(EEPROM_SIZE);
+    FILE *f = fopen(path, "rb");
+
+    if(!f)
+    {
+        perror(path);
+        exit(1);
+    }
+    *len = fread(data, 1, EEPROM_SIZE, f);
+    fclose(f);
+    return data;
+}
+
+//===================================================
+// Method to report the result of a transfer
+//===================================================
+int report(char *what, int status, long bytes, long start)
+{
+    long ms = now_ms() - start;
+
+    printf("%s status=%d bytes=%ld ms=%ld bytes_per_s=%ld frames=%lu resent=%lu crc_errors=%lu\n", what, status, bytes, ms,
+           ms ? bytes * 1000 / ms : 0, frames_sent, frames_resent, rx.crc_errors);
+    frames_sent = frames_resent = 0;
+    return status != IIC_OK;
+}
+
+//===================================================
+// Method to write, verify, read back and erase a random image
+//===================================================
+int selftest(long addr, long len)
+{
+    unsigned char *image = malloc(len), *back = malloc(len);
+    long i, start;
+    int status, fail = 0;
+
+    srand(getpid());
+    for(i = 0; i < len; i++)
+        image[i] = rand();
+
+    start = now_ms();
+    fail |= report("write", link_write(addr, image, len), len, start);
+    start = now_ms();
+    fail |= report("verify", link_verify(addr, image, len), len, start);
+    start = now_ms();
+    status = link_read(addr, back, len);
+    if(status == IIC_OK && memcmp(image, back, len))
+        status = IIC_ERR_CRC;
+    fail |= report("read", status, len, start);
+    start = now_ms();
+    status = link_erase(addr, len);
+    if(status == IIC_OK)
+        status = link_read(addr, back, len);
+    for(i = 0; i < len && status == IIC_OK; i++)
+        if(back[i] != 0xFF)
+            status = IIC_ERR_CRC;
+    fail |= report("erase", status, len, start);
+
+    printf("selftest %s\n", fail ? "FAILED" : "passed");
+    return fail;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned char *data;
+    long addr, len, start;
+    int fail;
+    FILE *f;
+
+    if(argc < 4)
+    {
+        fprintf(stderr, "usage: iic_host <port|!command> read|write|verify|erase|selftest <addr> [len|file] [file]\n");
+        return 2;
+    }
+    if((argv[1][0] == '!' ? open_program(argv[1] + 1) : open_port(argv[1])) < 0)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    proto_rx_init(&rx);
+    if(write(fd_out, "5", 1) != 1)      // Main menu: Host link
+        return 1;
+
+    addr = strtol(argv[3], 0, 16);
+    start = now_ms();
+    if(!strcmp(argv[2], "read") && argc == 6)
+    {
+        len = strtol(argv[4], 0, 16);
+        data = malloc(len);
+        fail = report("read", link_read(addr, data, len), len, start);
+        if(!fail && (f = fopen(argv[5], "wb")))
+        {
+            fwrite(data, 1, len, f);
+            fclose(f);
+        }
+    }
+    else if(!strcmp(argv[2], "write") && argc == 5)
+    {
+        data = load(argv[4], &len);
+        fail = report("write", link_write(addr, data, len), len, start);
+    }
+    else if(!strcmp(argv[2], "verify") && argc == 5)
+    {
+        data = load(argv[4], &len);
+        fail = report("verify", link_verify(addr, data, len), len, start);
+    }
+    else if(!strcmp(argv[2], "erase") && argc == 5)
+    {
+        len = strtol(argv[4], 0, 16);
+        fail = report("erase", link_erase(addr, len), len, start);
+    }
+    else if(!strcmp(argv[2], "selftest") && argc == 5)
+        fail = selftest(addr, strtol(argv[4], 0, 16));
+    else
+    {
+        fprintf(stderr, "iic_host: bad command\n");
+        return 2;
+    }
+
+    command(PROTO_QUIT, 0, 0, TIMEOUT_MS);
+    return fail;
+}
@@ -0,0 +1,149 @@
+//=====================================================================================
+// Binary framed protocol between a host and the EEPROM over RS232
+//
+// Frame:   SYNC  LEN  CMD  SEQ  payload (LEN - 2 bytes)  CRC-16 (MSB first)
+//
+// LEN counts CMD, SEQ and the payload. The CRC-16/CCITT (initial value 0xFFFF) covers LEN
+// to the end of the payload. Anything that isn't a whole frame with a good CRC is skipped,
+// so menu text or line noise ahead of a frame does no harm.
+//
+// Commands from the host, addresses and lengths are 3 bytes MSB first:
+//   PROTO_WRITE   addr data...     Data up to PROTO_DATA bytes, not crossing a page. A run
+//                                  of writes uses SEQ 0, 1, 2 ... and up to PROTO_WINDOW
+//                                  of them may be waiting for their PROTO_ACK.
+//   PROTO_READ    addr len         Target sends PROTO_DATA_FRAME frames, SEQ 0, 1, 2 ...,
+//                                  each of PROTO_DATA bytes except the last. The host
+//                                  acknowledges each with PROTO_ACK and may NAK to go back.
+//   PROTO_VERIFY  addr len crc32   Target compares the CRC-32 of the range, then PROTO_ACK
+//   PROTO_ERASE   addr len         Target fills the range with 0xFF, then PROTO_ACK
+//   PROTO_QUIT                     Target acknowledges and leaves the protocol
+//
+// PROTO_ACK carries SEQ and a status byte (IIC_OK, IIC_ERR_...). PROTO_NAK carries the
+// SEQ the receiver expects next; the sender goes back and resends from there.
+//
+// Shared by IIC.c and the host tool iic_host.c, each supplies crc16().
+//=====================================================================================
+#ifndef PROTO_H
+#define PROTO_H
+
+#define PROTO_SYNC        0xA5
+#define PROTO_DATA         128      // Data bytes per frame, one EEPROM page
+#define PROTO_MAX_LEN     (2 + 3 + PROTO_DATA)      // Largest LEN, a write frame
+#define PROTO_MAX_FRAME   (PROTO_MAX_LEN + 4)       // SYNC, LEN and CRC added
+#define PROTO_WINDOW         4      // Frames sent ahead of their acknowledgement
+
+#define PROTO_WRITE        'W'
+#define PROTO_READ         'R'
+#define PROTO_VERIFY       'V'
+#define PROTO_ERASE        'E'
+#define PROTO_QUIT         'Q'
+#define PROTO_DATA_FRAME   'D'
+#define PROTO_ACK          'A'
+#define PROTO_NAK          'N'
+
+// Frame parser state
+struct proto_rx {
+    int state;                      // Bytes of the frame received so far, 0 = looking for SYNC
+    int len;
+    unsigned char buf[PROTO_MAX_LEN + 3];   // LEN, CMD, SEQ, payload, CRC
+    unsigned long crc_errors;
+};
+
+unsigned int crc16(unsigned int crc, unsigned char *buf, int len);
+
+//===================================================
+// Method to reset a frame parser
+//===================================================
+void proto_rx_init(struct proto_rx *p)
+{
+    p->state = 0;
+    p->crc_errors = 0;
+}
+
+//=====================================================================
+// Method to feed one received byte to the frame parser
+// Returns 1 when a frame is complete, CMD is then buf[1], SEQ buf[2]
+// and the payload (len - 2 bytes) starts at buf + 3. Returns -1 for a
+// frame with a bad CRC, 0 otherwise.
+//=====================================================================
+int proto_rx_byte(struct proto_rx *p, int c)
+{
+    unsigned int crc;
+
+    if(p->state == 0)
+    {
+        if(c == PROTO_SYNC)
+            p->state = 1;
+        return 0;
+    }
+    if(p->state == 1)
+    {
+        if(c < 2 || c > PROTO_MAX_LEN)
+        {
+            p->state = c == PROTO_SYNC ? 1 : 0;     // Not a frame, look for the next SYNC
+            return 0;
+        }
+        p->len = c;
+    }
+    p->buf[p->state - 1] = c;
+    if(++p->state < p->len + 4)
+        return 0;
+
+    p->state = 0;
+    crc = crc16(0xFFFF, p->buf, p->len + 1);
+    if(crc != ((p->buf[p->len + 1] << 8) | p->buf[p->len + 2]))
+    {
+        p->crc_errors++;
+        return -1;
+    }
+    return 1;
+}
+
+//=====================================================================
+// Method to build a frame in out, at least PROTO_MAX_FRAME bytes
+// Returns the number of bytes to send
+//=====================================================================
+int proto_frame(unsigned char *out, int cmd, int seq, unsigned char *payload, int len)
+{
+    unsigned int crc;
+    int i;
+
+    out[0] = PROTO_SYNC;
+    out[1] = len + 2;
+    out[2] = cmd;
+    out[3] = seq;
+    for(i = 0; i < len; i++)
+        out[4 + i] = payload[i];
+    crc = crc16(0xFFFF, out + 1, len + 3);
+    out[len + 4] = (crc >> 8) & 0xFF;
+    out[len + 5] = crc & 0xFF;
+    return len + 6;
+}
+
+//===================================================
+// Methods to pack and unpack 3 and 4 byte numbers, MSB first
+//===================================================
+void proto_put24(unsigned char *p, long v)
+{
+    p[0] = (v >> 16) & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = v & 0xFF;
+}
+
+long proto_get24(unsigned char *p)
+{
+    return ((long)p[0] << 16) | ((long)p[1] << 8) | p[2];
+}
+
+void proto_put32(unsigned char *p, unsigned long v)
+{
+    proto_put24(p, (long)(v >> 8));
+    p[3] = v & 0xFF;
+}
+
+unsigned long proto_get32(unsigned char *p)
+{
+    return ((unsigned long)proto_get24(p) << 8) | p[3];
+}
+
+#endif
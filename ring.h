@@ -0,0 +1,93 @@
+//=====================================================================================
+// Single producer / single consumer byte ring buffer
+//
+// The producer only writes head and the consumer only writes tail, so when one side
+// is an interrupt handler and the other the main loop neither needs to mask interrupts.
+// Either side can be the handler: the UART receive and ADC rings are filled by their
+// ISRs, while uart_tx is filled by the main loop and drained by the ACIA's ISR.
+//
+// head and tail run freely and are reduced modulo the size when indexing, so the size
+// must be a power of two and head - tail is the number of bytes held even after they wrap.
+//
+// The 68K has a single core and does its stores in program order, so storing the data
+// before moving head (and reading it before moving tail) is all the ordering needed.
+//
+// Nothing here touches the hardware; the file can be included in a host program on its
+// own to exercise the ring.
+//=====================================================================================
+#ifndef RING_H
+#define RING_H
+
+struct ring {
+    unsigned char *buf;
+    unsigned int size;              // Power of two
+    volatile unsigned int head;     // Next byte to write, producer only
+    volatile unsigned int tail;     // Next byte to read, consumer only
+    unsigned long overflows;        // Bytes the producer dropped because the ring was full
+};
+
+//===================================================
+// Method to set up a ring over a buffer of size bytes
+//===================================================
+void ring_init(struct ring *r, unsigned char *buf, unsigned int size)
+{
+    r->buf = buf;
+    r->size = size;
+    r->head = 0;
+    r->tail = 0;
+    r->overflows = 0;
+}
+
+//===================================================
+// Method to get the number of bytes waiting to be read
+//===================================================
+unsigned int ring_used(struct ring *r)
+{
+    return r->head - r->tail;
+}
+
+//===================================================
+// Method to get the number of bytes that can be written
+//===================================================
+unsigned int ring_free(struct ring *r)
+{
+    return r->size - (r->head - r->tail);
+}
+
+//=====================================================================
+// Method for the producer to add len bytes
+// All or nothing, so records of len bytes stay whole. If they don't
+// fit they are counted in overflows and 0 is returned.
+//=====================================================================
+int ring_put(struct ring *r, unsigned char *data, unsigned int len)
+{
+    unsigned int head = r->head, i;
+
+    if(r->size - (head - r->tail) < len)
+    {
+        r->overflows += len;
+        return 0;
+    }
+    for(i = 0; i < len; i++)
+        r->buf[(head + i) & (r->size - 1)] = data[i];
+    r->head = head + len;       // Publish after the data is in place
+    return 1;
+}
+
+//=====================================================================
+// Method for the consumer to take len bytes
+// All or nothing, returns 0 if fewer than len bytes are waiting
+//=====================================================================
+int ring_get(struct ring *r, unsigned char *data, unsigned int len)
+{
+    unsigned int tail = r->tail, i;
+
+    if(r->head - tail < len)
+        return 0;
+    for(i = 0; i < len; i++)
+        data[i] = r->buf[(tail + i) & (r->size - 1)];
+    r->tail = tail + len;       // Release the space after the data is copied
+    return 1;
+}
+
+#endif